@@ -0,0 +1,261 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	bench.c
+ * @brief 	Microbenchmarks for the calls of the file system interface.
+ * @date	01/03/2017
+ *
+ * Usage: ./bench [repetitions] [output file]
+ *
+ * The benchmark formats its own device in disk_bench.dat, which it removes
+ * when it finishes, so disk.dat is left untouched. It writes one JSON
+ * object per line to the output file (bench_output.txt by default) with the
+ * throughput and the p50/p99/p999 latencies of each call for every
+ * combination of number of files, directory depth and I/O size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "include/filesystem.h"
+
+#define BENCH_IMAGE "disk_bench.dat"      // Device of the benchmark
+#define N_BLOCKS 49                       // 40 data blocks plus the superblock and the inode blocks
+#define DEV_SIZE (N_BLOCKS * BLOCK_SIZE)  // Device size, in bytes
+#define MAX_SAMPLES 100000
+#define MKDIR_ROUNDS 20
+
+enum { OP_CREATE, OP_OPEN, OP_READ, OP_WRITE, OP_LSEEK, OP_MKDIR, OP_RMDIR, OP_LSDIR, NUM_OPS };
+
+static const char *op_names[NUM_OPS] = {
+	"createFile", "openFile", "readFile", "writeFile", "lseekFile", "mkDir", "rmDir", "lsDir"
+};
+
+static const int file_counts[] = {1, 4, 8};
+static const int depths[] = {0, 1, 3};
+static const int io_sizes[] = {16, 256, 2048};
+
+#define COUNT(a) (int)(sizeof(a) / sizeof((a)[0]))
+
+typedef struct samples
+{
+	long ns[MAX_SAMPLES];
+	int n;
+} samples;
+
+static samples results[NUM_OPS];
+static fs_t *fs; // Handle of the device of the benchmark
+
+static long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void record(int op, long start)
+{
+	long elapsed = now_ns() - start;
+	if (results[op].n < MAX_SAMPLES)
+		results[op].ns[results[op].n++] = elapsed;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Writes the statistics of the samples of an operation and clears them.
+ */
+static void report(FILE *out, int op, int files, int depth, int io_size)
+{
+	samples *s = &results[op];
+	if (s->n == 0)
+		return;
+
+	qsort(s->ns, s->n, sizeof(long), cmp_long);
+	long total = 0;
+	for (int k = 0; k < s->n; k++)
+		total += s->ns[k];
+
+	fprintf(out, "{\"op\":\"%s\",\"files\":%d,\"depth\":%d,\"io_size\":%d,\"samples\":%d,"
+				 "\"ops_per_sec\":%.1f,\"p50_ns\":%ld,\"p99_ns\":%ld,\"p999_ns\":%ld}\n",
+			op_names[op], files, depth, io_size, s->n,
+			total > 0 ? s->n * 1e9 / total : 0.0,
+			s->ns[s->n * 50 / 100], s->ns[s->n * 99 / 100], s->ns[s->n * 999 / 1000]);
+	s->n = 0;
+}
+
+static int create_device(void)
+{
+	int fd = open(BENCH_IMAGE, O_CREAT | O_RDWR | O_TRUNC, 0666);
+	if (fd < 0)
+		return -1;
+
+	int ret = ftruncate(fd, DEV_SIZE);
+	close(fd);
+	return ret;
+}
+
+/*
+ * Runs one repetition over a freshly formatted device. Returns 0 if every
+ * call succeeded, -1 otherwise.
+ */
+static int run_once(int files, int depth, int io_size, int meta)
+{
+	char dir[100] = "/";
+	char path[133];
+	char data[BLOCK_SIZE + 1];
+	char rdbuffer[BLOCK_SIZE];
+	long start;
+	int fd;
+
+	if (fsMkFS(fs, DEV_SIZE) != 0 || fsMountFS(fs) != 0)
+		return -1;
+
+	for (int d = 0; d < depth; d++)
+	{
+		sprintf(dir + strlen(dir), "d%d/", d);
+		start = now_ns();
+		if (fsMkDir(fs, dir) != 0)
+			return -1;
+		if (meta)
+			record(OP_MKDIR, start);
+	}
+
+	for (int f = 0; f < files; f++)
+	{
+		sprintf(path, "%sf%d", dir, f);
+		start = now_ns();
+		if (fsCreateFile(fs, path) != 0)
+			return -1;
+		if (meta)
+			record(OP_CREATE, start);
+	}
+
+	memset(data, 'a', io_size);
+	data[io_size] = '\0';
+	for (int f = 0; f < files; f++)
+	{
+		sprintf(path, "%sf%d", dir, f);
+		start = now_ns();
+		fd = fsOpenFile(fs, path);
+		if (fd < 0)
+			return -1;
+		record(OP_OPEN, start);
+
+		start = now_ns();
+		if (fsWriteFile(fs, fd, data, io_size) != io_size)
+			return -1;
+		record(OP_WRITE, start);
+
+		start = now_ns();
+		if (fsLseekFile(fs, fd, -io_size, FS_SEEK_CUR) != 0)
+			return -1;
+		record(OP_LSEEK, start);
+
+		start = now_ns();
+		if (fsReadFile(fs, fd, rdbuffer, io_size) != io_size)
+			return -1;
+		record(OP_READ, start);
+
+		fsCloseFile(fs, fd);
+	}
+
+	if (meta)
+	{
+		int inodesDir[10];
+		char namesDir[10][33];
+		start = now_ns();
+		if (fsLsDir(fs, dir, inodesDir, namesDir) < 0)
+			return -1;
+		record(OP_LSDIR, start);
+
+		sprintf(path, "%sb/", dir);
+		for (int k = 0; k < MKDIR_ROUNDS; k++)
+		{
+			start = now_ns();
+			if (fsMkDir(fs, path) != 0)
+				return -1;
+			record(OP_MKDIR, start);
+
+			start = now_ns();
+			if (fsRmDir(fs, path) != 0)
+				return -1;
+			record(OP_RMDIR, start);
+		}
+	}
+
+	return fsUnmountFS(fs);
+}
+
+int main(int argc, char *argv[])
+{
+	int reps = argc > 1 ? atoi(argv[1]) : 50;
+	const char *out_path = argc > 2 ? argv[2] : "bench_output.txt";
+
+	if (reps <= 0)
+	{
+		fprintf(stderr, "Syntax: ./bench [repetitions] [output file]\n");
+		return -1;
+	}
+	if (create_device() != 0 || !(fs = fsOpen(BENCH_IMAGE)))
+	{
+		fprintf(stderr, "ERROR: UNABLE TO CREATE DISK FILE %s\n", BENCH_IMAGE);
+		unlink(BENCH_IMAGE);
+		return -1;
+	}
+	FILE *out = fopen(out_path, "w");
+	if (!out)
+	{
+		fprintf(stderr, "ERROR: UNABLE TO OPEN OUTPUT FILE %s\n", out_path);
+		fsClose(fs);
+		unlink(BENCH_IMAGE);
+		return -1;
+	}
+
+	for (int d = 0; d < COUNT(depths); d++)
+	{
+		for (int f = 0; f < COUNT(file_counts); f++)
+		{
+			for (int s = 0; s < COUNT(io_sizes); s++)
+			{
+				// Metadata calls do not depend on the I/O size, so they are measured once
+				int meta = (s == 0);
+				for (int r = 0; r < reps; r++)
+				{
+					if (run_once(file_counts[f], depths[d], io_sizes[s], meta) != 0)
+					{
+						fprintf(stderr, "ERROR: benchmark run failed (files=%d depth=%d io_size=%d)\n",
+								file_counts[f], depths[d], io_sizes[s]);
+						fclose(out);
+						fsClose(fs);
+						unlink(BENCH_IMAGE);
+						return -1;
+					}
+				}
+				report(out, OP_OPEN, file_counts[f], depths[d], io_sizes[s]);
+				report(out, OP_WRITE, file_counts[f], depths[d], io_sizes[s]);
+				report(out, OP_LSEEK, file_counts[f], depths[d], io_sizes[s]);
+				report(out, OP_READ, file_counts[f], depths[d], io_sizes[s]);
+				if (meta)
+				{
+					report(out, OP_CREATE, file_counts[f], depths[d], 0);
+					report(out, OP_MKDIR, file_counts[f], depths[d], 0);
+					report(out, OP_RMDIR, file_counts[f], depths[d], 0);
+					report(out, OP_LSDIR, file_counts[f], depths[d], 0);
+				}
+			}
+		}
+	}
+
+	fclose(out);
+	fsClose(fs);
+	unlink(BENCH_IMAGE);
+	return 0;
+}
@@ -5,75 +5,522 @@
  * order to read or read to and from the device.
  */
 
+#define _GNU_SOURCE // For fallocate and O_DIRECT
 #include "blocks_cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include "stats.h"
+#include "events.h"
 
 /****************/
 /* Disk access. */
 /****************/
 
+/*
+ * Opens the image with the given flags. If the host file system does not
+ * support O_DIRECT the image is opened through the page cache instead.
+ */
+static int openImage(char *deviceName, int flags) {
+	int fd = open(deviceName, flags);
+	if(fd < 0 && (flags & O_DIRECT) && errno == EINVAL)
+		fd = open(deviceName, flags & ~O_DIRECT);
+	return fd;
+}
+
 /*
  * Reads a block from the device and stores it in a buffer.
  * Returns 0 or -1 in case of error, including short
  * read.
+ *
+ * It is always inlined with a constant block size, so every supported size
+ * gets its own copy with the offset and length math folded into constants.
  */
-int bread(char *deviceName, int blockNumber, char *buffer) {
-	int fd = open(deviceName, O_RDONLY);
+static inline __attribute__((always_inline)) int doBread(char *deviceName, int blockNumber, char *buffer, const int blockSize, const int flags) {
+	int fd = openImage(deviceName, O_RDONLY | flags);
 
 	if(fd < 0){
 		/* fprintf(stderr, "ERROR: UNABLE TO OPEN DISK FILE %s \n", deviceName); */
 		return -1;
 	}
 
-	int len = lseek(fd, 0, SEEK_END) + 1;
-	if((BLOCK_SIZE*blockNumber+BLOCK_SIZE) > len) {
+	off_t len = lseek(fd, 0, SEEK_END) + 1;
+	if(((off_t)blockSize*blockNumber+blockSize) > len) {
 		close(fd);
 		return -1;
 	}
 
-	lseek(fd, BLOCK_SIZE*blockNumber, SEEK_SET);
+	lseek(fd, (off_t)blockSize*blockNumber, SEEK_SET);
 
 	int total_read, read_result;
 
 	total_read = 0;
 	do{
-		read_result = read(fd, buffer+total_read, BLOCK_SIZE-total_read);
+		read_result = read(fd, buffer+total_read, blockSize-total_read);
+		if(read_result <= 0) {
+			/* Also a transfer O_DIRECT refuses, as one that is not aligned */
+			close(fd);
+			return -1;
+		}
 		total_read = total_read + read_result;
-	} while(total_read < BLOCK_SIZE && read_result >= 0);
+	} while(total_read < blockSize);
 
 	close(fd);
+	statsDeviceRequest();
+	statsBlockRead(blockSize);
 
 	return 0;
 }
 
 /*
  * Writes a block from a buffer to the device.
- * Returns 0 or -1 in case of error.
+ * Returns 0 or -1 in case of error, including short
+ * write.
  */
-int bwrite(char *deviceName, int blockNumber, char*buffer) {
-	int fd = open(deviceName, O_WRONLY);
+static inline __attribute__((always_inline)) int doBwrite(char *deviceName, int blockNumber, char*buffer, const int blockSize, const int flags) {
+	int fd = openImage(deviceName, O_WRONLY | flags);
 
 	if(fd < 0){
 		/* fprintf(stderr, "ERROR: UNABLE TO OPEN DISK FILE %s \n", deviceName); */
 		return -1;
 	}
 
-	int len = lseek(fd, 0, SEEK_END) + 1;
-	if((BLOCK_SIZE*blockNumber+BLOCK_SIZE) > len) {
+	off_t len = lseek(fd, 0, SEEK_END) + 1;
+	if(((off_t)blockSize*blockNumber+blockSize) > len) {
 		close(fd);
 		return -1;
 	}
 
-	lseek(fd, BLOCK_SIZE*blockNumber, SEEK_SET);
+	lseek(fd, (off_t)blockSize*blockNumber, SEEK_SET);
 
 	int total_write, write_result;
 
 	total_write = 0;
 	do{
-		write_result = write(fd, buffer+total_write, BLOCK_SIZE-total_write);
+		write_result = write(fd, buffer+total_write, blockSize-total_write);
+		if(write_result <= 0) {
+			close(fd);
+			return -1;
+		}
 		total_write = total_write + write_result;
-	} while(total_write < BLOCK_SIZE && write_result >= 0);
+	} while(total_write < blockSize);
+
+	close(fd);
+	statsDeviceRequest();
+	statsBlockWrite(blockSize);
+
+	return 0;
+}
+
+/*
+ * Moves a run of consecutive blocks between the image and their buffers with
+ * preadv/pwritev, going on after short transfers.
+ * Returns 0 or -1 in case of error.
+ */
+static int transferRun(int fd, struct iovec *iov, int n, off_t offset, int write) {
+	while(n > 0){
+		ssize_t result = write ? pwritev(fd, iov, n, offset) : preadv(fd, iov, n, offset);
+		if(result <= 0)
+			return -1;
+		offset += result;
+		for(; n > 0 && (size_t)result >= iov->iov_len; iov++, n--)
+			result -= iov->iov_len;
+		if(n > 0){
+			iov->iov_base = (char *)iov->iov_base + result;
+			iov->iov_len -= result;
+		}
+	}
+	statsDeviceRequest();
+	return 0;
+}
+
+/*
+ * Reads or writes count blocks, each one with its own buffer, in the order of
+ * blockNumbers. Runs of consecutive block numbers are moved with a single
+ * preadv/pwritev call.
+ * Returns 0 or -1 in case of error, including short read.
+ */
+static inline __attribute__((always_inline)) int doBlockvec(char *deviceName, const int *blockNumbers, int count, char **buffers, const int blockSize, const int flags, const int write) {
+	int fd = openImage(deviceName, (write ? O_WRONLY : O_RDONLY) | flags);
+
+	if(fd < 0){
+		return -1;
+	}
+
+	off_t len = lseek(fd, 0, SEEK_END) + 1;
+	for(int first = 0, last; first < count; first = last){
+		for(last = first + 1; last < count && last - first < IOV_MAX && blockNumbers[last] == blockNumbers[last-1] + 1; last++);
+
+		off_t offset = (off_t)blockSize*blockNumbers[first];
+		if(blockNumbers[first] < 0 || offset + (off_t)blockSize*(last-first) > len) {
+			close(fd);
+			return -1;
+		}
+		struct iovec iov[last-first];
+		for(int b = first; b < last; b++){
+			iov[b-first].iov_base = buffers[b];
+			iov[b-first].iov_len = blockSize;
+		}
+		if(transferRun(fd, iov, last-first, offset, write) == -1){
+			close(fd);
+			return -1;
+		}
+		for(int b = first; b < last; b++){
+			if(write) statsBlockWrite(blockSize);
+			else statsBlockRead(blockSize);
+		}
+	}
+
+	close(fd);
+	return 0;
+}
+
+/*
+ * Same as doBlockvec for count blocks in consecutive buffers.
+ */
+static inline __attribute__((always_inline)) int doBlockv(char *deviceName, const int *blockNumbers, int count, char *buffers, const int blockSize, const int flags, const int write) {
+	char *each[count > 0 ? count : 1];
+	for(int b = 0; b < count; b++)
+		each[b] = buffers + (size_t)blockSize*b;
+	return doBlockvec(deviceName, blockNumbers, count, each, blockSize, flags, write);
+}
+
+/*
+ * Gives the space of count blocks back to the host by punching holes in the
+ * image, so they read as zeros. If the host file system cannot punch holes
+ * the blocks are overwritten with zeros instead.
+ * Returns 0 or -1 in case of error.
+ */
+static inline __attribute__((always_inline)) int doBdiscardv(char *deviceName, const int *blockNumbers, int count, const int blockSize, const int flags) {
+	int fd = openImage(deviceName, O_WRONLY | flags);
+
+	if(fd < 0){
+		return -1;
+	}
+
+	off_t len = lseek(fd, 0, SEEK_END) + 1;
+	for(int first = 0, last; first < count; first = last){
+		for(last = first + 1; last < count && blockNumbers[last] == blockNumbers[last-1] + 1; last++);
+
+		off_t offset = (off_t)blockSize*blockNumbers[first];
+		size_t run = (size_t)blockSize*(last-first);
+		if(blockNumbers[first] < 0 || offset + (off_t)run > len) {
+			close(fd);
+			return -1;
+		}
+		if(fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, run) == 0)
+			continue;
+		if(errno != EOPNOTSUPP && errno != ENOSYS) {
+			close(fd);
+			return -1;
+		}
+
+		char *zeros = NULL;
+		if(posix_memalign((void **)&zeros, DIRECT_ALIGN, run) == 0)
+			memset(zeros, 0, run);
+		size_t total_write = 0;
+		ssize_t write_result = 0;
+		while(zeros && total_write < run && (write_result = pwrite(fd, zeros+total_write, run-total_write, offset+total_write)) > 0)
+			total_write += write_result;
+		free(zeros);
+		if(total_write < run){
+			close(fd);
+			return -1;
+		}
+		statsDeviceRequest();
+		for(int b = first; b < last; b++) statsBlockWrite(blockSize);
+	}
+
+	close(fd);
+	return 0;
+}
+
+/*
+ * Makes the blocks written to the image durable, the data and the size
+ * needed to read it back but not the rest of its metadata.
+ * Returns 0 or -1 in case of error.
+ */
+static int bsync(char *deviceName) {
+	int fd = open(deviceName, O_WRONLY);
 
+	if(fd < 0){
+		return -1;
+	}
+	EVENT_BEGIN(EVENT_BSYNC, 0);
+	int ret = fdatasync(fd);
+	EVENT_END(EVENT_BSYNC, ret);
 	close(fd);
+	return ret == 0 ? 0 : -1;
+}
+
+/*
+ * O_DIRECT needs aligned buffers. The ones that are not aligned are replaced
+ * by an aligned copy for the request, which bounceOut copies back if asked
+ * and releases.
+ */
+static char *bounceIn(char *buffer, size_t len, int copy) {
+	char *io;
+	if(((uintptr_t)buffer & (DIRECT_ALIGN - 1)) == 0)
+		return buffer;
+	if(posix_memalign((void **)&io, DIRECT_ALIGN, len) != 0)
+		return NULL;
+	if(copy)
+		memcpy(io, buffer, len);
+	return io;
+}
+
+static void bounceOut(char *io, char *buffer, size_t len, int copy) {
+	if(!io || io == buffer)
+		return;
+	if(copy)
+		memcpy(buffer, io, len);
+	free(io);
+}
+
+/*
+ * Direct version of doBlockvec, with every buffer that is not aligned
+ * replaced by an aligned copy.
+ */
+static inline __attribute__((always_inline)) int doBlockvecDirect(char *deviceName, const int *blockNumbers, int count, char **buffers, const int blockSize, const int write) {
+	char *io[count > 0 ? count : 1];
+	int ret = 0, b;
+	for(b = 0; b < count && ret == 0; b++)
+		ret = (io[b] = bounceIn(buffers[b], blockSize, write)) ? 0 : -1;
+	if(ret == 0)
+		ret = doBlockvec(deviceName, blockNumbers, count, io, blockSize, O_DIRECT, write);
+	while(b-- > 0)
+		bounceOut(io[b], buffers[b], blockSize, ret == 0 && !write);
+	return ret;
+}
+
+/*
+ * One bread/bwrite pair, and their batched, vectored and discard versions,
+ * for every supported block size. The direct versions skip the page cache
+ * of the host.
+ */
+#define BLOCK_IO(size_) \
+static int bread##size_(char *deviceName, int blockNumber, char *buffer) { \
+	EVENT_BEGIN(EVENT_BREAD, blockNumber); \
+	int ret = doBread(deviceName, blockNumber, buffer, size_, 0); \
+	EVENT_END(EVENT_BREAD, blockNumber); \
+	return ret; \
+} \
+static int bwrite##size_(char *deviceName, int blockNumber, char *buffer) { \
+	EVENT_BEGIN(EVENT_BWRITE, blockNumber); \
+	int ret = doBwrite(deviceName, blockNumber, buffer, size_, 0); \
+	EVENT_END(EVENT_BWRITE, blockNumber); \
+	return ret; \
+} \
+static int breadv##size_(char *deviceName, const int *blockNumbers, int count, char *buffers) { \
+	EVENT_BEGIN(EVENT_BREAD, count ? blockNumbers[0] : 0); \
+	int ret = doBlockv(deviceName, blockNumbers, count, buffers, size_, 0, 0); \
+	EVENT_END(EVENT_BREAD, count); \
+	return ret; \
+} \
+static int bwritev##size_(char *deviceName, const int *blockNumbers, int count, char *buffers) { \
+	EVENT_BEGIN(EVENT_BWRITE, count ? blockNumbers[0] : 0); \
+	int ret = doBlockv(deviceName, blockNumbers, count, buffers, size_, 0, 1); \
+	EVENT_END(EVENT_BWRITE, count); \
+	return ret; \
+} \
+static int breadvec##size_(char *deviceName, const int *blockNumbers, int count, char **buffers) { \
+	EVENT_BEGIN(EVENT_BREAD, count ? blockNumbers[0] : 0); \
+	int ret = doBlockvec(deviceName, blockNumbers, count, buffers, size_, 0, 0); \
+	EVENT_END(EVENT_BREAD, count); \
+	return ret; \
+} \
+static int bwritevec##size_(char *deviceName, const int *blockNumbers, int count, char **buffers) { \
+	EVENT_BEGIN(EVENT_BWRITE, count ? blockNumbers[0] : 0); \
+	int ret = doBlockvec(deviceName, blockNumbers, count, buffers, size_, 0, 1); \
+	EVENT_END(EVENT_BWRITE, count); \
+	return ret; \
+} \
+static int bdiscardv##size_(char *deviceName, const int *blockNumbers, int count) { \
+	EVENT_BEGIN(EVENT_BWRITE, count ? blockNumbers[0] : 0); \
+	int ret = doBdiscardv(deviceName, blockNumbers, count, size_, 0); \
+	EVENT_END(EVENT_BWRITE, count); \
+	return ret; \
+} \
+static int breadDirect##size_(char *deviceName, int blockNumber, char *buffer) { \
+	EVENT_BEGIN(EVENT_BREAD, blockNumber); \
+	char *io = bounceIn(buffer, size_, 0); \
+	int ret = io ? doBread(deviceName, blockNumber, io, size_, O_DIRECT) : -1; \
+	bounceOut(io, buffer, size_, ret == 0); \
+	EVENT_END(EVENT_BREAD, blockNumber); \
+	return ret; \
+} \
+static int bwriteDirect##size_(char *deviceName, int blockNumber, char *buffer) { \
+	EVENT_BEGIN(EVENT_BWRITE, blockNumber); \
+	char *io = bounceIn(buffer, size_, 1); \
+	int ret = io ? doBwrite(deviceName, blockNumber, io, size_, O_DIRECT) : -1; \
+	bounceOut(io, buffer, size_, 0); \
+	EVENT_END(EVENT_BWRITE, blockNumber); \
+	return ret; \
+} \
+static int breadvDirect##size_(char *deviceName, const int *blockNumbers, int count, char *buffers) { \
+	EVENT_BEGIN(EVENT_BREAD, count ? blockNumbers[0] : 0); \
+	char *io = bounceIn(buffers, (size_t)size_ * count, 0); \
+	int ret = io ? doBlockv(deviceName, blockNumbers, count, io, size_, O_DIRECT, 0) : -1; \
+	bounceOut(io, buffers, (size_t)size_ * count, ret == 0); \
+	EVENT_END(EVENT_BREAD, count); \
+	return ret; \
+} \
+static int bwritevDirect##size_(char *deviceName, const int *blockNumbers, int count, char *buffers) { \
+	EVENT_BEGIN(EVENT_BWRITE, count ? blockNumbers[0] : 0); \
+	char *io = bounceIn(buffers, (size_t)size_ * count, 1); \
+	int ret = io ? doBlockv(deviceName, blockNumbers, count, io, size_, O_DIRECT, 1) : -1; \
+	bounceOut(io, buffers, (size_t)size_ * count, 0); \
+	EVENT_END(EVENT_BWRITE, count); \
+	return ret; \
+} \
+static int breadvecDirect##size_(char *deviceName, const int *blockNumbers, int count, char **buffers) { \
+	EVENT_BEGIN(EVENT_BREAD, count ? blockNumbers[0] : 0); \
+	int ret = doBlockvecDirect(deviceName, blockNumbers, count, buffers, size_, 0); \
+	EVENT_END(EVENT_BREAD, count); \
+	return ret; \
+} \
+static int bwritevecDirect##size_(char *deviceName, const int *blockNumbers, int count, char **buffers) { \
+	EVENT_BEGIN(EVENT_BWRITE, count ? blockNumbers[0] : 0); \
+	int ret = doBlockvecDirect(deviceName, blockNumbers, count, buffers, size_, 1); \
+	EVENT_END(EVENT_BWRITE, count); \
+	return ret; \
+} \
+static int bdiscardvDirect##size_(char *deviceName, const int *blockNumbers, int count) { \
+	EVENT_BEGIN(EVENT_BWRITE, count ? blockNumbers[0] : 0); \
+	int ret = doBdiscardv(deviceName, blockNumbers, count, size_, O_DIRECT); \
+	EVENT_END(EVENT_BWRITE, count); \
+	return ret; \
+}
+
+BLOCK_IO(1024)
+BLOCK_IO(2048)
+BLOCK_IO(4096)
+BLOCK_IO(8192)
+BLOCK_IO(16384)
+BLOCK_IO(32768)
+BLOCK_IO(65536)
+
+#define DEVICE(size_, shift_, kind_) \
+	{size_, shift_, bread##kind_##size_, bwrite##kind_##size_, breadv##kind_##size_, bwritev##kind_##size_, \
+	 breadvec##kind_##size_, bwritevec##kind_##size_, bdiscardv##kind_##size_, bsync}
+
+static const struct blockDevice devices[] = {
+	DEVICE(1024, 10, ), DEVICE(2048, 11, ), DEVICE(4096, 12, ), DEVICE(8192, 13, ),
+	DEVICE(16384, 14, ), DEVICE(32768, 15, ), DEVICE(65536, 16, ),
+};
+
+static const struct blockDevice direct_devices[] = {
+	DEVICE(1024, 10, Direct), DEVICE(2048, 11, Direct), DEVICE(4096, 12, Direct), DEVICE(8192, 13, Direct),
+	DEVICE(16384, 14, Direct), DEVICE(32768, 15, Direct), DEVICE(65536, 16, Direct),
+};
+
+/*
+ * Returns the block functions for a block size, or NULL if the size is not
+ * a power of two between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE.
+ */
+const struct blockDevice *blockDeviceFor(int blockSize) {
+	for(unsigned int i = 0; i < sizeof(devices)/sizeof(devices[0]); i++){
+		if(devices[i].size == blockSize)
+			return &devices[i];
+	}
+	return NULL;
+}
+
+/*
+ * Same as blockDeviceFor, for the functions that open the image with O_DIRECT.
+ */
+const struct blockDevice *blockDeviceDirect(int blockSize) {
+	for(unsigned int i = 0; i < sizeof(direct_devices)/sizeof(direct_devices[0]); i++){
+		if(direct_devices[i].size == blockSize)
+			return &direct_devices[i];
+	}
+	return NULL;
+}
 
+int bread(char *deviceName, int blockNumber, char *buffer) {
+	return bread2048(deviceName, blockNumber, buffer);
+}
+
+int bwrite(char *deviceName, int blockNumber, char*buffer) {
+	return bwrite2048(deviceName, blockNumber, buffer);
+}
+
+/*
+ * Orders the queued writes: the data blocks before the metadata blocks, and
+ * each group by block number.
+ */
+static int bbefore(blockQueue *q, int a, int b) {
+	int metaA = a < q->firstDataBlock, metaB = b < q->firstDataBlock;
+	return metaA != metaB ? metaB : a < b;
+}
+
+/*
+ * Submits the queued writes, the data blocks first and then the metadata.
+ */
+static int bsubmit(blockQueue *q, const struct blockDevice *dev, char *deviceName) {
+	for(int k = 1; k < q->count; k++){
+		int block = q->blockNumbers[k];
+		char *buffer = q->buffers[k];
+		int j;
+		for(j = k; j > 0 && bbefore(q, block, q->blockNumbers[j-1]); j--){
+			q->blockNumbers[j] = q->blockNumbers[j-1];
+			q->buffers[j] = q->buffers[j-1];
+		}
+		q->blockNumbers[j] = block;
+		q->buffers[j] = buffer;
+	}
+	int data = 0;
+	while(data < q->count && q->blockNumbers[data] >= q->firstDataBlock)
+		data++;
+	int ret = 0;
+	if(data > 0)
+		ret = dev->bwritevec(deviceName, q->blockNumbers, data, q->buffers);
+	if(ret != -1 && data < q->count)
+		ret = dev->bwritevec(deviceName, q->blockNumbers + data, q->count - data, q->buffers + data);
+	q->count = 0;
+	return ret;
+}
+
+void bplug(blockQueue *q) {
+	q->plugged++;
+}
+
+int bunplug(blockQueue *q, const struct blockDevice *dev, char *deviceName) {
+	if(q->plugged > 0 && --q->plugged > 0)
+		return 0;
+	return bsubmit(q, dev, deviceName);
+}
+
+int bqueueRead(blockQueue *q, const struct blockDevice *dev, char *deviceName, int blockNumber, char *buffer) {
+	for(int k = 0; k < q->count; k++){
+		if(q->blockNumbers[k] == blockNumber){
+			memcpy(buffer, q->buffers[k], dev->size);
+			return 0;
+		}
+	}
+	return dev->bread(deviceName, blockNumber, buffer);
+}
+
+int bqueueWrite(blockQueue *q, const struct blockDevice *dev, char *deviceName, int blockNumber, char *buffer) {
+	if(!q->plugged || q->window <= 1)
+		return dev->bwrite(deviceName, blockNumber, buffer);
+	for(int k = 0; k < q->count; k++){
+		if(q->blockNumbers[k] == blockNumber){
+			memcpy(q->buffers[k], buffer, dev->size);
+			return 0;
+		}
+	}
+	if(!q->slots)
+		return dev->bwrite(deviceName, blockNumber, buffer);
+	/* Until the queue is submitted the entries are in the order of their slots */
+	char *copy = q->slots + (size_t)q->count*dev->size;
+	memcpy(copy, buffer, dev->size);
+	q->blockNumbers[q->count] = blockNumber;
+	q->buffers[q->count++] = copy;
+	if(q->count >= q->window || q->count == QUEUE_DEPTH)
+		return bsubmit(q, dev, deviceName);
 	return 0;
 }
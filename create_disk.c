@@ -22,33 +22,34 @@
 int main ( int argc, char *argv[] )
 {
 
-	char dummy_block[BLOCK_SIZE];
-
-	if(argc != 2){
+	if(argc != 2 && argc != 3){
 		printf("ERROR: Incorrect number of arguments:\n");
-		printf("Syntax: ./create_disk <num_blocks>\n");
+		printf("Syntax: ./create_disk <num_blocks> [block_size]\n");
 		return -1;
 	}
 
 	int num_blocks = atoi(argv[1]);
+	int block_size = argc == 3 ? atoi(argv[2]) : BLOCK_SIZE;
+	if(block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1))){
+		printf("ERROR: The block size must be a power of two between %d and %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+		return -1;
+	}
 
 	int fd = open("disk.dat", O_CREAT | O_RDWR | O_TRUNC, 0666);
 
 	if(fd < 0){
 		fprintf(stderr, "ERROR: UNABLE TO OPEN DISK FILE disk.dat \n");
+		return -1;
 	}
 
-	memset(dummy_block, '0', BLOCK_SIZE);
-
-	int i;
-	int total_write, write_result;
-	for(i = 0; i < num_blocks; i++){
-		total_write = 0;
-		do{
-			write_result = write(fd, dummy_block+total_write, BLOCK_SIZE-total_write);
-			total_write = total_write + write_result;
-		}while(total_write < BLOCK_SIZE && write_result >= 0);
+	/* The image is created sparse: nothing is written and every block reads
+	 * as zeros until it is used, so the time does not depend on its size. */
+	if(ftruncate(fd, (off_t)num_blocks * block_size) < 0){
+		fprintf(stderr, "ERROR: UNABLE TO RESIZE DISK FILE disk.dat \n");
+		close(fd);
+		return -1;
 	}
 
+	close(fd);
 	return 0;
 }
@@ -0,0 +1,74 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	eventdump.c
+ * @brief 	Converts an event dump written by fsEventsDump to Chrome trace JSON.
+ * @date	01/03/2017
+ *
+ * Usage: ./eventdump <event dump> [output file]
+ *
+ * The output (stdout by default) can be loaded in chrome://tracing or
+ * Perfetto to see the calls, block I/O and metadata flushes of each thread
+ * on a timeline.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "include/filesystem.h"
+#include "include/events.h"
+
+static const char *kind_names[] = {
+	"mkFS", "mountFS", "unmountFS", "createFile", "removeFile", "openFile", "closeFile",
+	"readFile", "writeFile", "lseekFile", "mkDir", "rmDir", "lsDir", "renamePath", "rmTree", "copyTree",
+	"fsyncFile", "statFile", "openDirIter", "readDirIter", "closeDirIter", "bread", "bwrite", "inodeFlush", "superBlockFlush", "bsync"
+};
+_Static_assert(sizeof(kind_names) / sizeof(kind_names[0]) == EVENT_NUM_KINDS, "every kind of event needs a name");
+
+static const char *category(int kind)
+{
+	if (kind < FS_NUM_OPS)
+		return "api";
+	if (kind == EVENT_BREAD || kind == EVENT_BWRITE || kind == EVENT_BSYNC)
+		return "block";
+	return "metadata";
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Syntax: ./eventdump <event dump> [output file]\n");
+		return -1;
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if (!in) {
+		fprintf(stderr, "ERROR: UNABLE TO OPEN EVENT DUMP %s\n", argv[1]);
+		return -1;
+	}
+	FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+	if (!out) {
+		fprintf(stderr, "ERROR: UNABLE TO OPEN OUTPUT FILE %s\n", argv[2]);
+		fclose(in);
+		return -1;
+	}
+
+	struct fsEvent event;
+	int first = 1;
+	fprintf(out, "{\"traceEvents\":[\n");
+	while (fread(&event, sizeof(event), 1, in) == 1) {
+		if (event.kind >= EVENT_NUM_KINDS || (event.phase != 'B' && event.phase != 'E'))
+			continue;
+		// Chrome traces use microseconds
+		fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"%s\":%lld}}",
+				first ? "" : ",\n", kind_names[event.kind], category(event.kind), event.phase,
+				event.timestamp / 1000.0, event.tid,
+				event.kind < FS_NUM_OPS ? (event.phase == 'E' ? "ret" : "arg") : "block", event.arg);
+		first = 0;
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	fclose(in);
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	events.c
+ * @brief 	Per-thread ring buffers for the trace points of the file system.
+ * @date	01/03/2017
+ *
+ * Each thread only writes to its own ring, so recording an event needs no
+ * lock: the slot is filled and then the head is published with a release
+ * store. Rings are linked in a list when created and never freed, so
+ * fsEventsDump can read them from any thread.
+ */
+
+#include "include/filesystem.h"
+#include "include/events.h"
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct eventRing{
+
+  unsigned long head; //Number of events recorded by the thread.
+  unsigned int tid;
+  struct eventRing *next;
+  struct fsEvent events[EVENT_RING_SIZE];
+
+} eventRing;
+
+static __thread struct eventRing *ring=NULL;//Ring of the calling thread
+static struct eventRing *rings=NULL;//List of the rings of all the threads
+static unsigned int next_tid=0;
+
+/*
+ * @brief	Creates the ring of the calling thread and links it in the list.
+ * @return	The ring, or NULL if there is no memory.
+ */
+static struct eventRing *eventRingCreate(void)
+{
+	struct eventRing *r=calloc(1, sizeof(struct eventRing));
+	if(!r) return NULL;
+	r->tid=__atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+
+	r->next=__atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	return r;
+}
+
+/*
+ * @brief	Stores an event in the ring buffer of the calling thread.
+ */
+void eventRecord(int kind, char phase, long long arg)
+{
+	if(!ring && !(ring=eventRingCreate())) return;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	unsigned long head=ring->head;
+	struct fsEvent *event=&ring->events[head & (EVENT_RING_SIZE-1)];
+	event->timestamp=(unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+	event->tid=ring->tid;
+	event->kind=(unsigned short)kind;
+	event->phase=phase;
+	event->arg=arg;
+	__atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+}
+
+/*
+ * @brief	Writes the events kept in the rings of all the threads to a file.
+ * @return	Number of events written, -1 in case of error.
+ */
+int fsEventsDump(char *path)
+{
+#ifndef FS_EVENTS
+	printf("The file system was compiled without trace points (make EVENTS=1)\n");
+	return -1;
+#else
+	FILE *out=fopen(path, "wb");
+	if(!out){
+		printf("Error while opening the event dump\n");
+		return -1;
+	}
+
+	int written=0;
+	for(struct eventRing *r=__atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r=r->next){
+		unsigned long head=__atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned long first=head>EVENT_RING_SIZE ? head-EVENT_RING_SIZE : 0;
+		for(unsigned long k=first;k<head;k++){
+			if(fwrite(&r->events[k & (EVENT_RING_SIZE-1)], sizeof(struct fsEvent), 1, out)!=1){
+				fclose(out);
+				return -1;
+			}
+			written++;
+		}
+	}
+	if(fclose(out)) return -1;
+	return written;
+#endif
+}
@@ -9,48 +9,118 @@
 #include "include/filesystem.h" // Headers for the core functionality
 #include "include/auxiliary.h"  // Headers for auxiliary functions
 #include "include/metadata.h"   // Type and structure declaration of the file system
+#include "include/trace.h"      // Recording of the calls in the trace log
+#include "include/stats.h"      // Counters and latency histograms of the calls
+#include "include/events.h"     // Trace points for the event ring buffers
 #include <string.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
+#if (defined(__AVX2__) || defined(__SSE2__)) && !defined(FS_SCALAR)
+#include <immintrin.h>
+#endif
 
 
 #define NUM_INODES 40
 
-static struct inode inodes[NUM_INODES];//This structure will represent the inodes in an array where all inodes will be contained
-static struct sBlock superBlock;//This structure represents the superblock where metadata is stored
+_Static_assert(sizeof(struct sBlock)<=MIN_BLOCK_SIZE, "The superblock must fit in the smallest block");
+_Static_assert(NUM_INODES%8==0, "findEntry compares the inodes 8 or 4 at a time");
+_Static_assert(GROUP_INODES*NUM_GROUPS==NUM_INODES, "The inodes must be split evenly between the block groups");
+_Static_assert(sizeof(struct snapshot)<=SNAPSHOT_BLOCKS*MIN_BLOCK_SIZE, "The record of a snapshot must fit in its blocks");
+#define MAX_DIR_ITERS 8
+#define MAX_APPENDERS 8
+#define MAX_WRITE_BUFFERS 8
+#define WRITE_BUFFER_BLOCKS 4 //Blocks a write buffer holds before it is flushed
+#define DISCARD_BATCH 8 //Freed blocks that are discarded together
+
+//copyTree takes a buffer for every data block at once, and a read or a write of a whole file can take one more while it holds its range
+_Static_assert(POOL_BUFFERS>=MAX_WRITE_BUFFERS*WRITE_BUFFER_BLOCKS+MAX_APPENDERS+NUM_INODES+FILE_BLOCKS, "the buffer pool must hold every block buffer in use at once");
+_Static_assert(MAX_FILE_SIZE==FILE_BLOCKS*BLOCK_SIZE, "MAX_FILE_SIZE is the limit of the files with blocks of BLOCK_SIZE");
+
+static int trace_ids=0;//Last identifier given to a handle in the trace log
+static struct fs default_fs={.image=DEVICE_IMAGE, .snapshot_view=-1, .queue.window=QUEUE_DEPTH, .append_lock=PTHREAD_MUTEX_INITIALIZER};//File system used by the calls without a handle
 
 
 /*
- * @brief 	Generates the proper file system structure in a storage device, as designed by the student.
- * @return 	0 if success, -1 otherwise.
+ * @brief	Lays out an empty file system in memory: the superblock, the root inode and the block functions for the block size. Nothing is written.
+ * @return	0 if success, -1 otherwise.
  */
-
-int mkFS(long deviceSize)
+int formatFS(fs_t *fs, long deviceSize, int blockSize)
 {
 	if(deviceSize<50000 || deviceSize>10000000){//First we check that the size of the partition suits the requirements
 		printf("The device size must be between 50Kb and 10Mb\n");
 		return -1;
 	}
-	if(deviceSize%2048!=0){//We also need to assure that the size is multiple of the block size
-		printf("The device size must be a multiple of the block size: %d\n", BLOCK_SIZE);
+	const struct blockDevice *dev=deviceFor(fs, blockSize);
+	if(!dev){//The block size must be one of the sizes supported by the block layer
+		printf("The block size must be a power of two between %d and %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+		return -1;
+	}
+	if(deviceSize%blockSize!=0){//We also need to assure that the size is multiple of the block size
+		printf("The device size must be a multiple of the block size: %d\n", blockSize);
+		return -1;
+	}
+	//The inodes are stored after the superblock and the data blocks after the inodes
+	int inodes_per_block=blockSize/sizeof(struct inode);
+	int first_data_block=1+(NUM_INODES+inodes_per_block-1)/inodes_per_block;
+	if(deviceSize/blockSize<=first_data_block){
+		printf("The device is too small for blocks of %d bytes\n", blockSize);
 		return -1;
 	}
 	//Now we update some metadata
-	superBlock.partitionBlocks=(int)deviceSize/2048;
-	superBlock.num_items=1;//this will be the root inode
-	superBlock.mounted=0;
-	bzero(inodes, NUM_INODES*sizeof(struct inode));
-	bzero(superBlock.bitmap, 5*sizeof(char));
+	fs->dev=dev;
+	if(initBufferPool(fs)==-1){//The buffers for the blocks are allocated once for the block size
+		printf("Not enough memory for the file system\n");
+		return -1;
+	}
+	fs->superBlock.block_size=blockSize;
+	fs->superBlock.first_data_block=first_data_block;
+	fs->queue.firstDataBlock=first_data_block;//The metadata is written after the data it points to
+	fs->superBlock.partitionBlocks=(int)(deviceSize/blockSize);
+	fs->superBlock.num_items=1;//this will be the root inode
+	fs->superBlock.mounted=0;
+	fs->superBlock.dedup=0;
+	fs->superBlock.secure_erase=0;
+	fs->pending_discard=0;
+	bzero(fs->inodes, NUM_INODES*sizeof(struct inode));
+	bzero(fs->superBlock.bitmap, 5*sizeof(char));
+	bzero(fs->superBlock.block_refs, sizeof(fs->superBlock.block_refs));
+	bzero(fs->superBlock.block_hash, sizeof(fs->superBlock.block_hash));
+	bzero(fs->snapshots, sizeof(fs->snapshots));
+	bzero(fs->superBlock.snapshot_blocks, sizeof(fs->superBlock.snapshot_blocks));
 	//And intialize the root directory inode:
 	struct inode root;
 	bzero(&root, sizeof(struct inode));
-	strcpy(root.dir_path, "/");
-	root.type='D';
+	root.type='D';//The root has no name, its path is "/"
 	//Everything else for the inode shall remain empty for the root in the initial state.
 
-	inodes[0]=root;
+	fs->inodes[0]=root;
+	indexInodes(fs);
+
+	//The inode blocks are marked as not initialized, they are written when first used
+	fs->superBlock.magic=FS_MAGIC;
+	fs->superBlock.initialized_inode_blocks=0;
+	bzero(fs->disk_inodes, sizeof(fs->disk_inodes));
+	return 0;
+}
+
+/*
+ * @brief 	Generates the proper file system structure in a storage device, as designed by the student.
+ * @return 	0 if success, -1 otherwise.
+ */
+
+static int doMkFS(fs_t *fs, long deviceSize, int blockSize)
+{
+	if(formatFS(fs, deviceSize, blockSize)==-1){
+		return -1;
+	}
+	//Only the superblock is written
+	if(writeSuperBlock(fs)==-1){
+		printf("Error while writting\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -58,37 +128,42 @@ int mkFS(long deviceSize)
  * @brief 	Mounts a file system in the simulated device.
  * @return 	0 if success, -1 otherwise.
  */
-int mountFS(void)
+static int doMountFS(fs_t *fs)
 {
-	if(superBlock.mounted){//First we check if the disk is already mounted
+	if(fs->superBlock.mounted){//First we check if the disk is already mounted
 		printf("The disk is already mounted\n");
 		return -1;
 	}
-	//If not we write the contents of the disk to prevent any possible error
-	int cur_inode=0;
-	for(int i=1; i<9; i++){//For the blocks of inodes
-
-		char inode_block[5][sizeof(struct inode)];
-		int j;
-		for(j=0; j<5; j++){
-			memcpy(inode_block[j], &inodes[cur_inode],sizeof(struct inode));
-			cur_inode++;
-		}
-
-		if(bwrite(DEVICE_IMAGE, i, (char *) inode_block)==-1){
-			printf("Error while writting\n");
-			return -2;
-		} //write all the inodes to the current block
+	//If not we read the superblock, with the smallest block size as the block size is stored in it
+	char supblock[MIN_BLOCK_SIZE] __attribute__((aligned(DIRECT_ALIGN)));
+	if(deviceFor(fs, MIN_BLOCK_SIZE)->bread(fs->image, 0, supblock)==-1){
+		printf("Error while reading\n");
+		return -2;
+	}
+	struct sBlock disk_superblock;
+	memcpy(&disk_superblock, supblock, sizeof(struct sBlock));
+	//The block functions are chosen here, once, for the block size of the file system
+	if(disk_superblock.magic!=FS_MAGIC || !(fs->dev=deviceFor(fs, disk_superblock.block_size))){
+		printf("There is no file system in the disk\n");
+		return -1;
+	}
+	if(initBufferPool(fs)==-1){
+		printf("Not enough memory for the file system\n");
+		return -2;
+	}
+	fs->superBlock=disk_superblock;
+	fs->queue.firstDataBlock=disk_superblock.first_data_block;//The metadata is written after the data it points to
+	fs->pending_discard=0;
 
+	if(readInodes(fs)==-1 || readSnapshots(fs)==-1){//read the inodes and the snapshots from their blocks
+		printf("Error while reading\n");
+		return -2;
 	}
-	superBlock.mounted=1;
+	fs->superBlock.mounted=1;
+	bzero(fs->dir_iters, sizeof(fs->dir_iters));
 
 	//And we also write the superblock
-	char supblock[2048];
-	bzero(supblock, sizeof(supblock));
-	memcpy(supblock,&superBlock, sizeof(struct sBlock));
-
-	if(bwrite(DEVICE_IMAGE,0,supblock)==-1){
+	if(writeSuperBlock(fs)==-1){
 		printf("Error while writting\n");
 		return -2;
 	}
@@ -99,35 +174,62 @@ int mountFS(void)
  * @brief 	Unmounts the file system from the simulated device.
  * @return 	0 if success, -1 otherwise.
  */
-int unmountFS(void)
+static int doUnmountFS(fs_t *fs)
 {
-	superBlock.mounted=0;
-	//Here we only need to empty the superblock
-	char resetblock[2048];
-	bzero(resetblock, sizeof(resetblock));
-	if(bwrite(DEVICE_IMAGE,0,resetblock)==-1){//We will always checck when reading or writting if the operation was performed correctly
+	if(fs->snapshot_view!=-1){
+		printf("A snapshot is released with fsClose\n");
+		return -1;
+	}
+	for(int s=0;s<MAX_SNAPSHOTS;s++){//The opened snapshots read the device of this file system
+		if(fs->snapshot_views[s]){
+			printf("The snapshot %s is still opened\n", fs->snapshots[s].name);
+			return -1;
+		}
+	}
+	if(flushWriteBuffers(fs, -1, 0)==-1){//The buffered writes go to the disk before anything else
+		printf("Error while writting\n");
+		return -2;
+	}
+	releaseWriteBuffers(fs, -1);
+	fs->superBlock.mounted=0;
+	releaseTails(fs, -1);
+	if(discardBlocks(fs)==-1){//The freed blocks waiting to be discarded are discarded now
+		printf("Error while writting\n");
+		return -2;
+	}
+	//Here we only need to write the modified inodes and the superblock, so the bitmap and the deduplication index are kept in the disk
+	if(writeInodes(fs)==-1){
 		printf("Error while writting\n");
 		return -2;
 	}
+	if(writeSuperBlock(fs)==-1){//We will always checck when reading or writting if the operation was performed correctly
+		printf("Error while writting\n");
+		return -2;
+	}
+	freeBufferPool(fs);
 
-	return superBlock.mounted;
+	return fs->superBlock.mounted;
 }
 
 /*
  * @brief	Creates a new file, provided it it doesn't exist in the file system.
  * @return	0 if success, -1 if the file already exists, -2 in case of error.
  */
-int createFile(char *path)
+static int doCreateFile(fs_t *fs, char *path)
 {
-	if(superBlock.num_items>=40) {//We check for the amount of items
+	if(fs->superBlock.num_items>=40) {//We check for the amount of items
 		printf("There are too many elements in the File System\n");
 		return -2;
 	}
 
-	if(!superBlock.mounted){//We check if the disk is mounted
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
 		printf("disk not mounted yet\n");
 		return -2;
 	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
 	if(strlen(path)>132){//The maximum lenght of the directory
 		printf("Name of the path too long, try shortening the names of the directories\n");
 		return -2;
@@ -152,136 +254,62 @@ int createFile(char *path)
 		printf("The maximum depth is 3, you cannot create a file here\n");
 		return -2;
 	}
-	//Then we obtain the path of the directory containing this file with the path given
-	 aux_path=path;
-	 aux_char=*path; //This character will be used to read char by char until an "/" is found to measure the length.
-	int slash_pos=strlen(path), found=0, last=strlen(path);
-
-	aux_path+=last-1;
-	while(!found){
-		aux_char=*aux_path;
-		if(aux_char=='/')found=1;
-		else{
-			slash_pos--;
-			aux_path--;
-		}
+	//Then we obtain the directory containing this file with the path given
+	if(!depth || path[strlen(path)-1]=='/'){//A path ending in '/' names a directory
+		printf("The path of a file cannot end with '/'\n");
+		return -2;
 	}
-
-	char obtained_dir[strlen(path)];
-	int size_path=strlen(path);
-	bzero(obtained_dir, size_path);
-	memcpy(obtained_dir, path, slash_pos); //The obtained dir will be useful to place the newly created file as a content of the corresponding directory inode.
-
-	//We check if the directory exists
-	int f=0;
-	for(int k=0; k<NUM_INODES; k++){
-		if(!strcmp(obtained_dir, inodes[k].dir_path)) f=1;
+	char name[33];
+	int adv=lookupParent(fs, path, name);//The directory where the file is stored
+	if(adv==-2){//We also need to check if the name of the file is too long
+		printf("Name of the file too long, please insert a name under 32 characters\n");
+		return -1;
 	}
-	if(!f){
+	if(adv==-1){
 		printf("The directory where the file wants to be created does not exist\n");
 		return -2;
 	}
-
+	if(findEntry(fs, adv, name)!=-1){
+		printf("The file exist already\n");
+		return -1;
+	}
+	int slot=freeEntry(fs, adv);
+	if(slot==-1){
+		printf("Not enough space in the directory\n");
+		return -1;
+	}
 
 	//After all the checkings has been done we create the inode for the file:
 	struct inode new_file;
 	bzero(&new_file, sizeof(struct inode));
-	strcpy(new_file.file_path, path);
+	strcpy(new_file.name, name);
 	new_file.type='F';
+	new_file.parent=adv;
 	new_file.opened='N';
-	int n;
-	//Once the node is created we can perform some more checkings before it is saved into the disk
-	for(n=0;n<NUM_INODES;n++){
-		if(!bitmap_getbit(superBlock.bitmap,n)){
-			if(n>superBlock.partitionBlocks-9){//To avoid creating a block outside the partition
-				printf("No space remaining in the disk for files\n");
-				return -2;
-			}
-			char checkblock[2048];
-			bzero(checkblock, sizeof(checkblock));
-			if(bread(DEVICE_IMAGE, n+9, checkblock)==-1){//It can also happen that it goes outside the disk
-				printf("No space remaining in the disk for files\n");
-				return -2;
-			}
-			bitmap_setbit(superBlock.bitmap,n,1);//and we update the bitmap
-			break;
-		}
-	}
-	new_file.block=n+9;//We add up 9 as the first 8 blocks are for inodes plus one for the superblock
-
-	for(int i=0;i<NUM_INODES;++i){//traverse all inodes array to check if the file exists already
-		if(!strcmp(inodes[i].file_path, path) ){
-			printf("The file exist already\n");
-			return -1;
-		}
-	}
-	int i;
-	for(i=0;i<NUM_INODES;++i){//traverse all the inodes array and asign the first free space to this inode
-		if(!strcmp(inodes[i].dir_path, "") && !strcmp(inodes[i].file_path, "")){
-			inodes[i]=new_file;
-			inodes[i].id=i;
-			break;
-		}
+	//The block map is left empty, the data blocks are only chosen when they are first written
+	int i=allocInode(fs, adv, 'F');//The file goes in the block group of its directory
+	if(i==-1){//The count of items said there was a free inode
+		printf("There are too many elements in the File System\n");
+		return -2;
 	}
+	fs->inodes[i]=new_file;
+	fs->inodes[i].id=i;
+	indexInode(fs, i);
 
 	//Adding a reference to the directory where the file is stored:
-	int coinciding_path=0, adv=0;
-	while(!coinciding_path && adv<NUM_INODES){
-		if(!strcmp(obtained_dir, inodes[adv].dir_path)){
-			coinciding_path=1;
-			inodes[i].parent = &inodes[adv];
-		}
-		else{
-			adv++;
-		}
-	}
-
-	if(strlen(path)-strlen(obtained_dir)>32){//We also need to check if the name of the file is too long
-		printf("Name of the file too long, please insert a name under 32 characters\n");
-		return -1;
-	}
-
-
-	int checkparent=0;
-	for(int j=0;j<10;++j){//traverse all the inodes array and asign the first free space to this inode
-		if(!inodes[adv].contents[j]){
-			inodes[adv].contents[j]=&inodes[i];
-			checkparent++;
-			break;
-		}
-	}
-	if(!checkparent){
-		printf("Not enough space in the directory\n");
-		return -1;
-	}
+	fs->inodes[adv].contents[slot]=i;
 
 
 	//lastly we have to update the disk if there is any modification
-	if (superBlock.mounted){
-		int cur_inode=0;
-		for(int x=1; x<9; x++){//For the blocks of inodes
-			char inode_block[5][sizeof(struct inode)];
-
-			for(int y=0; y<5; y++){
-				memcpy(inode_block[y], &inodes[cur_inode],sizeof(struct inode));
-				cur_inode++;
-			}
-
-			if(bwrite(DEVICE_IMAGE, x, (char *) inode_block)==-1){
-				printf("Error while writting\n");
-				return -2;
-			} //write all the inodes to the current block
-		}
+	if(writeInodes(fs)==-1){//write all the inodes to their blocks
+		printf("Error while writting\n");
+		return -2;
 	}
 
-	superBlock.num_items++;
-
+	fs->superBlock.num_items++;
 
-	char supblock[2048];
-	bzero(supblock, sizeof(supblock));
-	memcpy(supblock,&superBlock, sizeof(struct sBlock));
 
-	if(bwrite(DEVICE_IMAGE,0,supblock)==-1){//write the superblock to the disk
+	if(writeSuperBlock(fs)==-1){//write the superblock to the disk
 		printf("Error while writting\n");
 		return -2;
 	}
@@ -292,72 +320,57 @@ int createFile(char *path)
  * @brief	Deletes a file, provided it exists in the file system.
  * @return	0 if success, -1 if the file does not exist, -2 in case of error..
  */
-int removeFile(char *path)
+static int doRemoveFile(fs_t *fs, char *path)
 {
-	if(!superBlock.mounted){//First we check if it is mounted
+	if(!fs->superBlock.mounted){//First we check if it is mounted
 		printf("disk not mounted yet\n");
 		return -1;
 	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
 	/*For removing a file we will have to remove the inode of the file itself,
 	clean the block where the file was stored and romove the reference to the inode
 	from its prent directory*/
 
 	//First we will check if the file's inode exists and remove it:
 
-	for(int i=0;i<NUM_INODES;++i){//traverse all inodes array to check if the file exists
-		if(!strcmp(inodes[i].file_path, path)){
-			if(inodes[i].opened=='Y'){//If the file is open it cannot be deleted
-				printf("The file is opened so it cannot be deleted.\n");
-				return -2;
-			}
-			bitmap_setbit(superBlock.bitmap,(inodes[i].block-8),0);
-
-			for(int j=0;j<10;j++){
-				if(inodes[i].parent->contents[j]==&inodes[i]){
-					inodes[i].parent->contents[j]=NULL;
-				}
-			}
-			//Removing the reference from the parent directory of the file:
-			memset(&inodes[i], 0, sizeof(struct inode));
-
-			if (superBlock.mounted){
-				int cur_inode=0;
-				for(int x=1; x<9; x++){//For the blocks of inodes
-					char inode_block[5][sizeof(struct inode)];
-					memset(inode_block, '0', 5*sizeof(struct inode));
-					for(int y=0; y<5; y++){
-						memcpy(inode_block[y], &inodes[cur_inode],sizeof(struct inode));
-						cur_inode++;
-					}
+	int i=lookupPath(fs, path);
+	if(i!=-1 && fs->inodes[i].type=='F'){
+		if(fs->inodes[i].opened=='Y'){//If the file is open it cannot be deleted
+			printf("The file is opened so it cannot be deleted.\n");
+			return -2;
+		}
+		int blocks[FILE_BLOCKS];
+		if(releaseDataBlocks(fs, blocks, fileBlocks(fs, i, blocks))==-1){//The blocks are only freed if no other file shares them
+			printf("Error while writting\n");
+			return -2;
+		}
 
-					if(bwrite(DEVICE_IMAGE, x, (char *) inode_block)==-1){
-						printf("Error while writting\n");
-						return -2;
-					} //write all the inodes to the current block
-				}
-			}
-			//Now we delete the data block
-			char resetFileblock[2048];
-			bzero(resetFileblock, sizeof(resetFileblock));
-			if(bwrite(DEVICE_IMAGE,inodes[i].block,resetFileblock)==-1){//And we update the disk
-				printf("Error while writting\n");
-				return -2;
+		for(int j=0;j<10;j++){
+			if(fs->inodes[fs->inodes[i].parent].contents[j]==i){
+				fs->inodes[fs->inodes[i].parent].contents[j]=0;
 			}
-			superBlock.num_items--;
+		}
+		//Removing the reference from the parent directory of the file:
+		memset(&fs->inodes[i], 0, sizeof(struct inode));
+		indexInode(fs, i);
 
+		if(writeInodes(fs)==-1){//write all the inodes to their blocks
+			printf("Error while writting\n");
+			return -2;
+		}
+		fs->superBlock.num_items--;
 
-			char supblock[2048];
-			bzero(supblock, sizeof(supblock));
-			memcpy(supblock,&superBlock, sizeof(struct sBlock));
 
-			if(bwrite(DEVICE_IMAGE,0,supblock)==-1){//Lastley we have to update the superblock
-				printf("Error while writting\n");
-				return -2;
-			}
-			return 0;
+		if(writeSuperBlock(fs)==-1){//Lastley we have to update the superblock
+			printf("Error while writting\n");
+			return -2;
 		}
+		return 0;
 	}
-	printf("Error removing the file\n");//It should never come here
+	printf("The file does not exist\n");
 	return -1;
 }
 
@@ -365,44 +378,128 @@ int removeFile(char *path)
  * @brief	Opens an existing file.
  * @return	The file descriptor if possible, -1 if file does not exist, -2 in case of error..
  */
-int openFile(char *path)
+static int doOpenFile(fs_t *fs, char *path)
 {
-	if(!superBlock.mounted){//We check if the disk is mounted
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
 		printf("disk not mounted yet\n");
 		return -1;
 	}
-	int found_file=0;
-	int i;
-	for(i=0;i<NUM_INODES;++i){//traverse all inodes array to check if the file exists already
-		if(!strcmp(inodes[i].file_path, path) ){
-			found_file=1;
-			break;
-		}
+	int i=lookupPath(fs, path);
+	if(i==-1 || fs->inodes[i].type!='F'){//If it does not exist it means is an error
+		printf("The file that is being opened does not exist\n");
+		return -1;
 	}
 
-	if(!found_file){//If it does not exist it means is an error
+	fs->inodes[i].opened='Y';
+
+	fs->inodes[i].seek_ptr=0;
+	return fs->inodes[i].id;
+}
+
+/*
+ * @brief	Opens an existing file in append mode, finding the end of its data and keeping the block that holds it in memory.
+ * @return	The file descriptor if possible, -1 if file does not exist, -2 in case of error.
+ */
+static int doOpenFileAppend(fs_t *fs, char *path)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -2;
+	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
+	int i=lookupPath(fs, path);
+	if(i==-1 || fs->inodes[i].type!='F'){
 		printf("The file that is being opened does not exist\n");
 		return -1;
 	}
+	if(flushWriteBuffers(fs, i, 0)==-1){//The tail is looked for in the disk
+		printf("Error while writting\n");
+		return -2;
+	}
+	pthread_mutex_lock(&fs->append_lock);
+	int t=findTail(fs, i);
+	if(t!=-1){//The appenders of a file share its tail, and move it one at a time, so their writes never overlap
+		fs->inodes[i].seek_ptr=fs->tails[t].tail;
+		pthread_mutex_unlock(&fs->append_lock);
+		return fs->inodes[i].id;
+	}
+	for(t=0;t<MAX_APPENDERS && fs->tails[t].used;t++);
+	if(t==MAX_APPENDERS){
+		pthread_mutex_unlock(&fs->append_lock);
+		printf("There are too many files opened in append mode\n");
+		return -2;
+	}
+	struct appendTail *tail=&fs->tails[t];
+	if(!(tail->block=getBuffers(fs, 1))){
+		pthread_mutex_unlock(&fs->append_lock);
+		printf("Error while reading\n");
+		return -2;
+	}
+	//The tail is the end of the file, and its block is kept unless the next append starts a new one
+	tail->used=1;
+	tail->inode=i;
+	tail->tail=fs->inodes[i].size;
+	if(loadTail(fs, t)==-1){
+		tail->used=0;
+		putBuffers(fs, tail->block, 1);
+		pthread_mutex_unlock(&fs->append_lock);
+		printf("Error while reading\n");
+		return -2;
+	}
+	pthread_mutex_unlock(&fs->append_lock);
 
-	inodes[i].opened='Y';
-
-	inodes[i].seek_ptr=0;
-	return inodes[i].id;
+	fs->inodes[i].opened='Y';
+	fs->inodes[i].seek_ptr=tail->tail;
+	return fs->inodes[i].id;
 }
 
 /*
  * @brief	Closes a file.
  * @return	0 if success, -1 otherwise.
  */
-int closeFile(int fileDescriptor)
+static int doCloseFile(fs_t *fs, int fileDescriptor)
 {
-	if(!superBlock.mounted){//First we check for the disk
+	if(!fs->superBlock.mounted){//First we check for the disk
 		printf("disk not mounted yet\n");
 		return -1;
 	}
+	if(fs->write_behind && flushWriteBuffers(fs, -1, fs->write_behind_age)==-1){//The buffers that are too old are written on every call
+		printf("Error while writting\n");
+	}
+	//The buffered writes go to the disk before the file is closed, and it stays opened if they cannot so they are not lost
+	if(flushWriteBuffers(fs, fileDescriptor, 0)==-1){
+		printf("Error while writting\n");
+		return -1;
+	}
+	releaseWriteBuffers(fs, fileDescriptor);
 	//And we only have to update the state of the file
-	inodes[fileDescriptor].opened='N';
+	fs->inodes[fileDescriptor].opened='N';
+	releaseTails(fs, fileDescriptor);
+	return 0;
+}
+
+/*
+ * @brief	Writes the buffered writes of a file and makes them durable in the device.
+ * @return	0 if success, -1 otherwise.
+ */
+static int doFsyncFile(fs_t *fs, int fileDescriptor)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -1;
+	}
+	if(fileDescriptor<0 || fileDescriptor>=NUM_INODES || fs->inodes[fileDescriptor].type!='F' || fs->inodes[fileDescriptor].opened=='N'){
+		printf("File is not opened\n");
+		return -1;
+	}
+	//The blocks and the metadata are written first and then the device is asked to keep them
+	if(flushWriteBuffers(fs, fileDescriptor, 0)==-1 || fs->dev->bsync(fs->image)==-1){
+		printf("Error while writting\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -410,16 +507,16 @@ int closeFile(int fileDescriptor)
  * @brief	Reads a number of bytes from a file and stores them in a buffer.
  * @return	Number of bytes properly read, -1 in case of error.
  */
-int readFile(int fileDescriptor, void *buffer, int numBytes)
+static int doReadFile(fs_t *fs, int fileDescriptor, void *buffer, int numBytes)
 {
 	//Same checkings as always
-	if(!superBlock.mounted){
+	if(!fs->superBlock.mounted){
 		printf("disk not mounted yet\n");
 		return -1;
 	}
 	int i;
 	for(i=0;i<40;i++){
-		if(inodes[i].id==fileDescriptor){
+		if(fs->inodes[i].id==fileDescriptor){
 			break;
 		}
 	}
@@ -428,23 +525,47 @@ int readFile(int fileDescriptor, void *buffer, int numBytes)
 		return -1;
 	}
 
-	if(inodes[i].opened=='N'){
+	if(fs->inodes[i].opened=='N'){
 		printf("File is not opened\n");
 		return -1;
 	}
-	if(numBytes+inodes[i].seek_ptr>2048){//We make sure it does not read outside the block
-		numBytes=2048-inodes[i].seek_ptr;
+	if(fs->write_behind && flushWriteBuffers(fs, -1, fs->write_behind_age)==-1){//The buffers that are too old are written on every call
+		printf("Error while writting\n");
+	}
+	if(numBytes+fs->inodes[i].seek_ptr>fs->inodes[i].size){//We make sure it does not read after the end of the file
+		numBytes=fs->inodes[i].size-fs->inodes[i].seek_ptr;
 	}
-	//Now we perform the read
-	char rdbuffer[2048];
-	bzero(rdbuffer, sizeof(rdbuffer));
-	if(bread(DEVICE_IMAGE, inodes[i].block, rdbuffer)==-1){
+	if(numBytes<=0) return 0;
+	//Now we perform the read of the blocks in the range with one request, the holes read as zeros
+	int first=fs->inodes[i].seek_ptr/fs->dev->size, last=(fs->inodes[i].seek_ptr+numBytes-1)/fs->dev->size;
+	int blocks[FILE_BLOCKS], nblocks=0;
+	for(int k=first;k<=last;k++){
+		if(fs->inodes[i].blocks[k]) blocks[nblocks++]=fs->inodes[i].blocks[k];
+	}
+	char *rdbuffer=getBuffers(fs, last-first+1);
+	if(!rdbuffer || (nblocks && fs->dev->breadv(fs->image, blocks, nblocks, rdbuffer)==-1)){
+		if(rdbuffer) putBuffers(fs, rdbuffer, last-first+1);
 		printf("Error while reading\n");
 		return -2;
 	}
-	memcpy(buffer,(void *)rdbuffer+inodes[i].seek_ptr,numBytes);//update the buffer
+	for(int k=last, b=nblocks;k>=first;k--){//Each block is moved to its place in the range, from the end
+		char *place=rdbuffer+(size_t)(k-first)*fs->dev->size;
+		if(!fs->inodes[i].blocks[k]){
+			memset(place, 0, fs->dev->size);
+			continue;
+		}
+		char *read=rdbuffer+(size_t)(--b)*fs->dev->size;
+		if(read!=place) memcpy(place, read, fs->dev->size);
+	}
+	int w=findWriteBuffer(fs, i);
+	for(int b=0;w!=-1 && b<fs->write_buffers[w].count;b++){//The buffered writes are newer than the disk
+		int k=fs->write_buffers[w].index[b];
+		if(k>=first && k<=last) memcpy(rdbuffer+(size_t)(k-first)*fs->dev->size, fs->write_buffers[w].blocks[b], fs->dev->size);
+	}
+	memcpy(buffer, rdbuffer+fs->inodes[i].seek_ptr%fs->dev->size, numBytes);//update the buffer
+	putBuffers(fs, rdbuffer, last-first+1);
 
-	inodes[i].seek_ptr+=numBytes;//update the seek pointer of the file
+	fs->inodes[i].seek_ptr+=numBytes;//update the seek pointer of the file
 
 	return numBytes;
 }
@@ -453,16 +574,20 @@ int readFile(int fileDescriptor, void *buffer, int numBytes)
  * @brief	Writes a number of bytes from a buffer and into a file.
  * @return	Number of bytes properly written, -1 in case of error.
  */
-int writeFile(int fileDescriptor, void *buffer, int numBytes)
+static int doWriteFile(fs_t *fs, int fileDescriptor, void *buffer, int numBytes)
 {
 	//Same checkings as always
-	if(!superBlock.mounted){
+	if(!fs->superBlock.mounted){
 		printf("disk not mounted yet\n");
 		return -1;
 	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -1;
+	}
 	int i;
 	for(i=0;i<40;i++){
-		if(inodes[i].id==fileDescriptor){
+		if(fs->inodes[i].id==fileDescriptor){
 			break;
 		}
 	}
@@ -473,30 +598,74 @@ int writeFile(int fileDescriptor, void *buffer, int numBytes)
 	if(numBytes>=strlen(buffer)){//To avoid copying the end of file character
 		numBytes=strlen(buffer);
 	}
-	if(inodes[i].opened=='N'){
+	if(fs->inodes[i].opened=='N'){
 		printf("File is not opened\n");
 		return -1;
 	}
-	if(numBytes+inodes[i].seek_ptr>2048){//We make sure it does not write outside the block
-		numBytes=2048-inodes[i].seek_ptr;
+	int t=findTail(fs, i);
+	if(t!=-1){//In append mode the seek pointer is not used, the bytes go to the tail
+		return appendWrite(fs, t, buffer, numBytes);
+	}
+	int max_size=FILE_BLOCKS*fs->dev->size;
+	if(numBytes+fs->inodes[i].seek_ptr>max_size){//We make sure it does not write outside the file
+		numBytes=max_size-fs->inodes[i].seek_ptr;
+	}
+	if(fs->write_behind){//The bytes wait in memory, and the buffers that are too old are written now
+		int ret=bufferedWrite(fs, i, buffer, numBytes);
+		if(ret>=0 && flushWriteBuffers(fs, -1, fs->write_behind_age)==-1){
+			printf("Error while writting\n");
+			return -2;
+		}
+		return ret;
 	}
 
-	//Now we just need to write on the file
-	//For that we first read the data block of the file
-	char rdbuffer[2048];
-	bzero(rdbuffer, sizeof(rdbuffer));
-	if(bread(DEVICE_IMAGE, inodes[i].block, rdbuffer)==-1){
-		printf("Error while reading\n");
+	//Now we just need to write on the file, one block at a time
+	char *rdbuffer=getBuffers(fs, 1);
+	if(!rdbuffer){
+		printf("Error while writting\n");
 		return -2;
 	}
+	int dirty=0;
+	bplug(&fs->queue);//The data blocks and the metadata are submitted together at the end
+	for(int done=0;done<numBytes;){
+		int k=(fs->inodes[i].seek_ptr+done)/fs->dev->size, offset=(fs->inodes[i].seek_ptr+done)%fs->dev->size;
+		int count=fs->dev->size-offset<numBytes-done ? fs->dev->size-offset : numBytes-done;
+
+		//For that we first read the data block, if the file already has it and it is not completely overwritten
+		bzero(rdbuffer, fs->dev->size);
+		if(fs->inodes[i].blocks[k] && count<fs->dev->size && bqueueRead(&fs->queue, fs->dev, fs->image, fs->inodes[i].blocks[k], rdbuffer)==-1){
+			if(dirty) syncMetadata(fs);
+			bunplug(&fs->queue, fs->dev, fs->image);
+			putBuffers(fs, rdbuffer, 1);
+			printf("Error while reading\n");
+			return -2;
+		}
+		memcpy(rdbuffer+offset, (char *)buffer+done, count);//store in a buffer what is going to be written
 
-	memcpy(rdbuffer+inodes[i].seek_ptr,buffer,numBytes);//store in a buffer what is going to be written
-
-	if(bwrite(DEVICE_IMAGE, inodes[i].block, (char *)rdbuffer)==-1){//And perform the write
+		int ret=dedupWrite(fs, i, k, rdbuffer);//And perform the write, copying the block first if it is shared
+		if(ret==-1){
+			if(dirty) syncMetadata(fs);//The blocks already written are kept
+			bunplug(&fs->queue, fs->dev, fs->image);
+			putBuffers(fs, rdbuffer, 1);
+			printf("Error while writting\n");
+			return -2;
+		}
+		dirty|=ret;
+		done+=count;
+	}
+	putBuffers(fs, rdbuffer, 1);
+	int size=fs->inodes[i].size;
+	if(fs->inodes[i].seek_ptr+numBytes>size){//The file grows up to the last byte written
+		fs->inodes[i].size=fs->inodes[i].seek_ptr+numBytes;
+	}
+	//The new blocks are saved in the metadata once for the whole write, a new length only needs the inode
+	int ret=dirty ? syncMetadata(fs) : size!=fs->inodes[i].size ? writeInodes(fs) : 0;
+	if(bunplug(&fs->queue, fs->dev, fs->image)==-1 || ret==-1){
+		fs->inodes[i].size=size;
 		printf("Error while writting\n");
 		return -2;
 	}
-	inodes[i].seek_ptr+=numBytes;//Lastly we update the seek pointer of the file
+	fs->inodes[i].seek_ptr+=numBytes;//Lastly we update the seek pointer of the file
 
 	return numBytes;
 }
@@ -505,71 +674,86 @@ int writeFile(int fileDescriptor, void *buffer, int numBytes)
  * @brief	Modifies the position of the seek pointer of a file.
  * @return	0 if succes, -1 otherwise.
  */
-int lseekFile(int fileDescriptor, long offset, int whence)
+static int doLseekFile(fs_t *fs, int fileDescriptor, long offset, int whence)
 {
-	if(!superBlock.mounted){//We check if the disk is mounted
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
 		printf("disk not mounted yet\n");
 		return -1;
 	}
+	if(fs->write_behind && flushWriteBuffers(fs, -1, fs->write_behind_age)==-1){//The buffers that are too old are written on every call
+		printf("Error while writting\n");
+	}
+	int max_size=FILE_BLOCKS*fs->dev->size;
 switch(whence){//Depending on the whence the pointer needs to be updated
-	case 0://Current plus offset
-		inodes[fileDescriptor].seek_ptr=inodes[fileDescriptor].seek_ptr+offset;
-		if((inodes[fileDescriptor].seek_ptr>2048) || inodes[fileDescriptor].seek_ptr<0){
+	case FS_SEEK_CUR://Current plus offset
+		fs->inodes[fileDescriptor].seek_ptr=fs->inodes[fileDescriptor].seek_ptr+offset;
+		if((fs->inodes[fileDescriptor].seek_ptr>max_size) || fs->inodes[fileDescriptor].seek_ptr<0){
 			printf("The pointer goes out of bounds\n");
 			return -1;
 		}
 		return 0;
 
-	case 2://End of the file
-		inodes[fileDescriptor].seek_ptr=2048;
-		if((inodes[fileDescriptor].seek_ptr>2048) || inodes[fileDescriptor].seek_ptr<0){
-			printf("The pointer goes out of bounds\n");
-			return -1;
-		}
+	case FS_SEEK_END://End of the file, after its last byte
+		fs->inodes[fileDescriptor].seek_ptr=fs->inodes[fileDescriptor].size;
 		return 0;
 
-	case 1://Beggining of the file
-		inodes[fileDescriptor].seek_ptr=0;
-		if((inodes[fileDescriptor].seek_ptr>2048) || inodes[fileDescriptor].seek_ptr<0){
-			printf("The pointer goes out of bounds\n");
-			return -1;
-		}
+	case FS_SEEK_BEGIN://Beggining of the file
+		fs->inodes[fileDescriptor].seek_ptr=0;
 		return 0;
 
 	default://In the case the whence is not valid
-		printf("The second argument must me an integer from 1 to 3\n");
+		printf("The whence must be FS_SEEK_CUR, FS_SEEK_END or FS_SEEK_BEGIN\n");
+		return -1;
+	}
+}
+
+/*
+ * @brief	Fills stat with the type, the length and the number of data blocks of a file or directory.
+ * @return	0 if success, -1 if the path does not exist, -2 in case of error.
+ */
+static int doStatFile(fs_t *fs, char *path, fsFileStat *stat)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -2;
+	}
+	int i=lookupPath(fs, path);
+	if(i==-1){
+		printf("The path does not exist\n");
 		return -1;
 	}
+	int blocks[FILE_BLOCKS];
+	stat->inode=fs->inodes[i].id;
+	stat->type=fs->inodes[i].type;
+	stat->size=fs->inodes[i].type=='F' ? fs->inodes[i].size : 0;
+	stat->blocks=fs->inodes[i].type=='F' ? fileBlocks(fs, i, blocks) : 0;
+	return 0;
 }
 
 /*
  * @brief	Creates a new directory provided it it doesn't exist in the file system.
  * @return	0 if success, -1 if the directory already exists, -2 in case of error.
  */
-int mkDir(char *path)
+static int doMkDir(fs_t *fs, char *path)
 {
 	//Same checkings as always
-	if(superBlock.num_items>=40) {
+	if(fs->superBlock.num_items>=40) {
 		printf("There are too many elements in the File System\n");
 		return -2;
 	}
 
-	if(!superBlock.mounted){
+	if(!fs->superBlock.mounted){
 		printf("disk not mounted yet\n");
 		return -2;
 	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
 	if(strlen(path)>99){
 		printf("Name of the path too long, try shortening the names of the directories\n");
 		return -2;
 	}
-	//Now we will check if the directory to be created already exists:
-	for(int x=0;x<NUM_INODES;++x){//traverse all inodes array to check if the file exists
-		if(!strcmp(inodes[x].dir_path, path)){
-			//In this case the directory to be created already exists.
-			printf("The directory already exists\n");
-			return -1;
-		}
-	}
 	//We also need to check the depth is not greater than 3, for that we will count the '/' of the path
 	char * aux_path=path;
 	char aux_char=*path;
@@ -589,112 +773,62 @@ int mkDir(char *path)
 		return -2;
 	}
 
-	//Then we obtain the path of the directory containing this directory with the path given
-	aux_path=path;
-	aux_char=*path; //This character will be used to read char by char until an "/" is found to measure the length.
-	int slash_pos=strlen(path), found=0, last=strlen(path);
-
-	aux_path+=last-1;
-	while(found!=2){
-		aux_char=*aux_path;
-		if(aux_char=='/'){
-			found++;
-			if(found==1){
-				slash_pos--;
-				aux_path--;
-			}
-		}
-		else{
-			slash_pos--;
-			aux_path--;
-		}
+	//Then we obtain the directory containing this directory with the path given
+	if(depth<2 || path[strlen(path)-1]!='/'){//The path of a directory ends in '/'
+		printf("The path of a directory must end with '/'\n");
+		return -2;
 	}
-
-	char obtained_dir[strlen(path)];
-	int size_path=strlen(path);
-	bzero(obtained_dir, size_path);
-	memcpy(obtained_dir, path, slash_pos); //The obtained dir will be useful to place the newly created file as a content of the corresponding directory inode.
-
-	if(strlen(path)-strlen(obtained_dir)>32){//We check the name length
+	char name[33];
+	int adv=lookupParent(fs, path, name);
+	if(adv==-2){//We check the name length
 		printf("Name of the directory too long, it must have under 32 characters\n");
 		return -2;
 	}
+	if(adv==-1){//If the directory is not found
+		printf("There is no such directory\n");
+		return -2;
+	}
+	//Now we will check if the directory to be created already exists:
+	if(findEntry(fs, adv, name)!=-1){
+		printf("The directory already exists\n");
+		return -1;
+	}
+	int slot=freeEntry(fs, adv);
+	if(slot==-1){
+		printf("Not enough space in the directory\n");
+		return -1;
+	}
 
 	//Creating the inode for the new directory:
 	struct inode new_dir;
 	bzero(&new_dir, sizeof(struct inode));
-	strcpy(new_dir.dir_path, path);
+	strcpy(new_dir.name, name);
 	new_dir.type='D';
+	new_dir.parent=adv;
 
-	int i;
-	for(i=0;i<NUM_INODES;++i){//traverse all the inodes array and asign the first free space to this inode
-		if(!strcmp(inodes[i].dir_path, "") && !strcmp(inodes[i].file_path, "")){
-			inodes[i]=new_dir;
-			inodes[i].id=i;
-			break;
-		}
-	}
-
-	//Adding a reference to the directory where the file is stored:
-	int coinciding_path=0, adv=0;
-	while(!coinciding_path && adv<NUM_INODES){
-		if(!strcmp(obtained_dir, inodes[adv].dir_path)){
-			coinciding_path=1;
-			inodes[i].parent = &inodes[adv];
-		}
-		else{
-			adv++;
-		}
-	}
-
-	if(!coinciding_path){//If the directory is not found
-		printf("There is no such directory\n");
+	int i=allocInode(fs, adv, 'D');//The directories are spread between the block groups
+	if(i==-1){//The count of items said there was a free inode
+		printf("There are too many elements in the File System\n");
 		return -2;
 	}
+	fs->inodes[i]=new_dir;
+	fs->inodes[i].id=i;
+	indexInode(fs, i);
 
-	else{
-
-		int checkparent=0;
-		for(int j=0;j<10;++j){//we update the contents
-			if(!inodes[adv].contents[j]){
-				inodes[adv].contents[j]=&inodes[i];
-				checkparent++;
-				break;
-			}
-		}
-		if(!checkparent){
-			printf("Not enough space in the directory\n");
-			return -1;
-		}
-	}
+	//Adding a reference to the directory where the directory is stored:
+	fs->inodes[adv].contents[slot]=i;
 
 	//Now we update the inodes
 
-	if (superBlock.mounted){//we check if the disk is mounted again (just in case)
-		int cur_inode=0;
-		for(int x=1; x<9; x++){//For the blocks of inodes
-			char inode_block[5][sizeof(struct inode)];
-
-			for(int y=0; y<5; y++){
-				memcpy(inode_block[y], &inodes[cur_inode],sizeof(struct inode));
-				cur_inode++;
-			}
-
-			if(bwrite(DEVICE_IMAGE, x, (char *) inode_block)==-1){
-				printf("Error while writting\n");
-				return -2;
-			} //write all the inodes to the current block
-		}
+	if(writeInodes(fs)==-1){//write all the inodes to their blocks
+		printf("Error while writting\n");
+		return -2;
 	}
 
-	superBlock.num_items++;
-
+	fs->superBlock.num_items++;
 
-	char supblock[2048];
-	bzero(supblock, sizeof(supblock));
-	memcpy(supblock,&superBlock, sizeof(struct sBlock));
 
-	if(bwrite(DEVICE_IMAGE,0,supblock)==-1){//Lastly we update the superblock
+	if(writeSuperBlock(fs)==-1){//Lastly we update the superblock
 		printf("Error while writting\n");
 		return -2;
 	}
@@ -705,119 +839,2106 @@ int mkDir(char *path)
  * @brief	Deletes a directory, provided it exists in the file system.
  * @return	0 if success, -1 if the directory does not exist, -2 in case of error..
  */
-int rmDir(char *path)
+static int doRmDir(fs_t *fs, char *path)
 {
-	if(!superBlock.mounted){//Check if the disk is mounteds
+	if(!fs->superBlock.mounted){//Check if the disk is mounteds
 		printf("disk not mounted yet\n");
 		return -1;
 	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
 
 	//First we will check if the directory's inode exists and remove it:
 
-	for(int i=0;i<NUM_INODES;++i){//traverse all inodes array to check if the directory exists
-		if(!strcmp(inodes[i].dir_path, path)){
-			//REMOVE HERE THE DATA STORED IN THE FILE BLOCK.
-			for(int k=0;k<10;++k){
-				//printf("A: %d, B: %d\n", i, k);
-				//printf("%c\n", inodes[i].contents[k]->type);
-
-				if(inodes[i].contents[k]!=NULL){
-					//The directory has contents inside
-					printf("The directory has contents inside\n");
-					return -2;
-				}
+	int i=lookupPath(fs, path);
+	if(i==0){//The root cannot be removed
+		printf("The root directory cannot be deleted\n");
+		return -2;
+	}
+	if(i!=-1 && fs->inodes[i].type=='D'){
+		for(int k=0;k<10;++k){
+			if(fs->inodes[i].contents[k]!=0){
+				//The directory has contents inside
+				printf("The directory has contents inside\n");
+				return -2;
 			}
+		}
 
-			for(int j=0;j<10;j++){
-				if(inodes[i].parent->contents[j]==&inodes[i]){
-					inodes[i].parent->contents[j]=NULL;
-				}
+		for(int j=0;j<10;j++){
+			if(fs->inodes[fs->inodes[i].parent].contents[j]==i){
+				fs->inodes[fs->inodes[i].parent].contents[j]=0;
 			}
-			//Removing the inode:
-			memset(&inodes[i], 0, sizeof(struct inode));
-
-			//Now we update the inode blocks
-
-			if (superBlock.mounted){
-				int cur_inode=0;
-				for(int x=1; x<9; x++){//For the blocks of inodes
-					char inode_block[5][sizeof(struct inode)];
-
-					for(int y=0; y<5; y++){
-						memcpy(inode_block[y], &inodes[cur_inode],sizeof(struct inode));
-						cur_inode++;
-					}
+		}
+		//Removing the inode:
+		memset(&fs->inodes[i], 0, sizeof(struct inode));
+		indexInode(fs, i);
 
-					if(bwrite(DEVICE_IMAGE, x, (char *) inode_block)==-1){
-						printf("Error while writting\n");
-						return -2;
-					} //write all the inodes to the current block
-				}
-			}
+		//Now we update the inode blocks
 
-			superBlock.num_items--;
+		if(writeInodes(fs)==-1){//write all the inodes to their blocks
+			printf("Error while writting\n");
+			return -2;
+		}
 
+		fs->superBlock.num_items--;
 
-			char supblock[2048];
-			bzero(supblock, sizeof(supblock));
-			memcpy(supblock,&superBlock, sizeof(struct sBlock));
 
-			if(bwrite(DEVICE_IMAGE,0,supblock)==-1){//Lastly we update the superblock
-				printf("Error while writting\n");
-				return -2;
-			}
-			return 0;
+		if(writeSuperBlock(fs)==-1){//Lastly we update the superblock
+			printf("Error while writting\n");
+			return -2;
 		}
+		return 0;
 	}
-		//directory does not exist
-		printf("The directory does not exist\n");
-		return -1;
+	//directory does not exist
+	printf("The directory does not exist\n");
+	return -1;
 }
 
 /*
  * @brief	Lists the content of a directory and stores the inodes and names in arrays.
  * @return	The number of items in the directory, -1 if the directory does not exist, -2 in case of error..
  */
-int lsDir(char *path, int inodesDir[10], char namesDir[10][33])
+static int doLsDir(fs_t *fs, char *path, int inodesDir[10], char namesDir[10][33])
 {	/*******************************************************************
 	**NOTE: For this function we also print the results in the terminal*
 	********************************************************************/
-	if(!superBlock.mounted){//We check if the disk is mounted
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
 		printf("disk not mounted yet\n");
 		return -1;
 	}
-	//First we will check if the directory's inode exists and remove it:
+	//First we will check if the directory's inode exists:
 
-	for(int i=0;i<NUM_INODES;++i){//traverse all inodes array to check if the directory exists
-		if(!strcmp(inodes[i].dir_path, path)){
+	int i=lookupPath(fs, path);
+	if(i!=-1 && fs->inodes[i].type=='F'){//In the case of the ls being performed over a file path there is an error
+		printf("The path of the arguments is from a file. This path is required to be from a directory\n");
+		return -2; //The path is from a file not from a directory
+	}
+	if(i!=-1){
+		for(int k=0;k<10;++k){//If it is found we start copying the contents into the array given as a parameter
+			if(fs->inodes[i].contents[k]!=0){
+				struct inode *item=&fs->inodes[fs->inodes[i].contents[k]];
+				inodesDir[k]=item->id;
+				if(item->type!='D' && item->type!='F'){//Unknown file type.
+					printf("Unknown element type\n");
+					return -2;
+				}
+				strcpy(namesDir[k], item->name);
+				printf("%s%s\n", item->name, item->type=='D' ? "/" : "");
+			}
+		}
+		return 0;
+	}
+	//directory does not exist
+	printf("The directory does not exist\n");
+	return -1;
+}
 
-			for(int k=0;k<10;++k){//If it is found we start copying the contents into the array given as a parameter
-				if(inodes[i].contents[k]!=NULL){
-					inodesDir[k]=inodes[i].contents[k]->id;
-					if(inodes[i].contents[k]->type=='D'){//In the case the content is a directory
-						strcpy(namesDir[k],inodes[i].contents[k]->dir_path);
-						printf("%s\n", inodes[i].contents[k]->dir_path);
-					}
-					else if(inodes[i].contents[k]->type=='F'){//In the case the content is a file
-						strcpy(namesDir[k],inodes[i].contents[k]->file_path);
-						printf("%s\n", inodes[i].contents[k]->file_path);
+/*
+ * @brief	Renames or moves a file or a directory with all its contents, replacing the file in the new path if it exists.
+ * @return	0 if success, -1 if the old path does not exist or the new one is a directory that exists, -2 in case of error.
+ */
+static int doRenamePath(fs_t *fs, char *oldPath, char *newPath)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -2;
+	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
+	int i=lookupPath(fs, oldPath);
+	if(i==-1){
+		printf("The path to rename does not exist\n");
+		return -1;
+	}
+	if(i==0){
+		printf("The root directory cannot be renamed\n");
+		return -2;
+	}
+	int len=strlen(newPath);
+	if(!len || (newPath[len-1]=='/')!=(fs->inodes[i].type=='D')){//Only directories end in '/'
+		printf("The new path must be of the same type as the old one\n");
+		return -2;
+	}
+	char name[33];
+	int adv=lookupParent(fs, newPath, name);//The directory where the inode is moved
+	if(adv==-2){
+		printf("Name too long, please insert a name under 32 characters\n");
+		return -2;
+	}
+	if(adv==-1){
+		printf("There is no such directory\n");
+		return -2;
+	}
+	for(int d=adv;d!=0;d=fs->inodes[d].parent){//A directory cannot be moved inside itself
+		if(d==i){
+			printf("A directory cannot be moved inside itself\n");
+			return -2;
+		}
+	}
+	//The depth of everything that is moved must still be at most 3
+	int depth=treeHeight(fs, i);
+	for(char *aux_path=newPath;*aux_path;aux_path++){
+		if(*aux_path=='/') depth++;
+	}
+	if(depth>5){
+		printf("The maximum depth is 3, you cannot move it here\n");
+		return -2;
+	}
+
+	int target=findEntry(fs, adv, name);//The inode that is replaced, if any
+	if(target==i) return 0;
+	if(target!=-1 && (fs->inodes[target].type!='F' || fs->inodes[i].type!='F')){
+		printf("The new path already exists\n");
+		return -1;
+	}
+	if(target!=-1 && fs->inodes[target].opened=='Y'){
+		printf("The file is opened so it cannot be replaced.\n");
+		return -2;
+	}
+	int slot=-1;
+	if(target!=-1){//The inode takes the entry of the replaced file
+		for(int k=0;k<10;k++){
+			if(fs->inodes[adv].contents[k]==target) slot=k;
+		}
+	}
+	else if(adv!=fs->inodes[i].parent){
+		slot=freeEntry(fs, adv);
+		if(slot==-1){
+			printf("Not enough space in the directory\n");
+			return -1;
+		}
+	}
+
+	if(target!=-1){//The replaced file is removed as removeFile does
+		int blocks[FILE_BLOCKS];
+		if(releaseDataBlocks(fs, blocks, fileBlocks(fs, target, blocks))==-1){
+			printf("Error while writting\n");
+			return -2;
+		}
+		memset(&fs->inodes[target], 0, sizeof(struct inode));
+		indexInode(fs, target);
+		fs->superBlock.num_items--;
+	}
+	if(slot!=-1){//Only the two directories and the inode itself change, the contents keep their names
+		for(int j=0;j<10;j++){
+			if(fs->inodes[fs->inodes[i].parent].contents[j]==i){
+				fs->inodes[fs->inodes[i].parent].contents[j]=0;
+			}
+		}
+		fs->inodes[adv].contents[slot]=i;
+		fs->inodes[i].parent=adv;
+	}
+	strcpy(fs->inodes[i].name, name);
+	indexInode(fs, i);
+
+	if(writeInodes(fs)==-1){//write the modified inode blocks
+		printf("Error while writting\n");
+		return -2;
+	}
+	if(target!=-1 && writeSuperBlock(fs)==-1){//The superblock only changes when a file is replaced
+		printf("Error while writting\n");
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Deletes a file or a directory with everything inside, writing the metadata only once.
+ * @return	0 if success, -1 if the path does not exist, -2 in case of error.
+ */
+static int doRmTree(fs_t *fs, char *path)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -2;
+	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
+	int i=lookupPath(fs, path);
+	if(i==-1){
+		printf("The path to remove does not exist\n");
+		return -1;
+	}
+	if(i==0){
+		printf("The root directory cannot be deleted\n");
+		return -2;
+	}
+	int tree[NUM_INODES], blocks[NUM_INODES], nblocks=0;
+	int count=collectTree(fs, i, tree);
+	for(int k=0;k<count;k++){//Nothing is removed if any of the files is opened
+		if(fs->inodes[tree[k]].type=='F' && fs->inodes[tree[k]].opened=='Y'){
+			printf("A file inside is opened so it cannot be deleted.\n");
+			return -2;
+		}
+	}
+
+	//Everything is updated in memory first
+	for(int j=0;j<10;j++){
+		if(fs->inodes[fs->inodes[i].parent].contents[j]==i){
+			fs->inodes[fs->inodes[i].parent].contents[j]=0;
+		}
+	}
+	for(int k=0;k<count;k++){
+		if(fs->inodes[tree[k]].type=='F'){
+			nblocks+=fileBlocks(fs, tree[k], blocks+nblocks);
+		}
+		memset(&fs->inodes[tree[k]], 0, sizeof(struct inode));
+		indexInode(fs, tree[k]);
+	}
+	fs->superBlock.num_items-=count;
+
+	//And then the freed data blocks and the metadata are written once
+	if(releaseDataBlocks(fs, blocks, nblocks)==-1 || syncMetadata(fs)==-1){
+		printf("Error while writting\n");
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Copies a file or a directory with everything inside to a new path, writing the metadata only once.
+ * @return	0 if success, -1 if the source does not exist or the destination exists, -2 in case of error.
+ */
+static int doCopyTree(fs_t *fs, char *srcPath, char *dstPath)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -2;
+	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
+	int i=lookupPath(fs, srcPath);
+	if(i==-1){
+		printf("The path to copy does not exist\n");
+		return -1;
+	}
+	if(flushWriteBuffers(fs, -1, 0)==-1){//The blocks are copied from the disk
+		printf("Error while writting\n");
+		return -2;
+	}
+	int len=strlen(dstPath);
+	if(!len || (dstPath[len-1]=='/')!=(fs->inodes[i].type=='D')){//Only directories end in '/'
+		printf("The new path must be of the same type as the old one\n");
+		return -2;
+	}
+	char name[33];
+	int adv=lookupParent(fs, dstPath, name);//The directory where the copy is placed
+	if(adv==-2){
+		printf("Name too long, please insert a name under 32 characters\n");
+		return -2;
+	}
+	if(adv==-1){
+		printf("There is no such directory\n");
+		return -2;
+	}
+	if(findEntry(fs, adv, name)!=-1){
+		printf("The new path already exists\n");
+		return -1;
+	}
+	int slot=freeEntry(fs, adv);
+	if(slot==-1){
+		printf("Not enough space in the directory\n");
+		return -1;
+	}
+	int depth=treeHeight(fs, i);//The depth of the copy must still be at most 3
+	for(char *aux_path=dstPath;*aux_path;aux_path++){
+		if(*aux_path=='/') depth++;
+	}
+	if(depth>5){
+		printf("The maximum depth is 3, you cannot copy it here\n");
+		return -2;
+	}
+	int tree[NUM_INODES];
+	int count=collectTree(fs, i, tree), free_inodes=0;
+	for(int n=0;n<NUM_INODES;n++) free_inodes+=!fs->inodes[n].type;
+	//The inodes themselves are counted, so allocInode cannot fail below even if the count of items is wrong
+	if(fs->superBlock.num_items+count>NUM_INODES || free_inodes<count){
+		printf("There are too many elements in the File System\n");
+		return -2;
+	}
+
+	//The new inodes are created in memory, every directory before its contents
+	int copy[NUM_INODES], src[NUM_INODES+1], dst[NUM_INODES+1], nblocks=0;
+	for(int k=0;k<count;k++){
+		int free_inode=allocInode(fs, k ? copy[fs->inodes[tree[k]].parent] : adv, fs->inodes[tree[k]].type);
+		copy[tree[k]]=free_inode;
+
+		struct inode *node=&fs->inodes[free_inode];
+		*node=fs->inodes[tree[k]];
+		node->id=free_inode;
+		node->parent=k ? copy[fs->inodes[tree[k]].parent] : adv;
+		if(node->type=='D'){//The contents are linked once all the inodes exist
+			bzero(node->contents, sizeof(node->contents));
+		}
+		else{
+			node->opened='N';
+			node->seek_ptr=0;
+			int n=0, shared=0;
+			for(int b=0;b<FILE_BLOCKS && n!=-1;b++){//The holes stay as holes in the copy
+				if(!node->blocks[b]) continue;
+				n=node->blocks[b]-fs->superBlock.first_data_block;
+				if(fs->superBlock.dedup){//With deduplication the copy shares the data block, while the counter allows it
+					if(fs->superBlock.block_refs[n]==255) n=-1;
+					else fs->superBlock.block_refs[n]++, shared++;
+				}
+				else if((n=allocDataBlock(fs, nblocks ? dst[nblocks-1]-fs->superBlock.first_data_block+1 : groupFirstBlock(fs, free_inode/GROUP_INODES)))!=-1){//The copies are kept together
+					src[nblocks]=node->blocks[b];
+					dst[nblocks++]=n+fs->superBlock.first_data_block;
+					node->blocks[b]=n+fs->superBlock.first_data_block;
+				}
+			}
+			if(n==-1){//We undo the copy, the metadata in the disk has not been modified
+				printf("No space remaining in the disk for files\n");
+				for(int b=0;b<nblocks;b++){
+					bitmap_setbit(fs->superBlock.bitmap,dst[b]-fs->superBlock.first_data_block,0);
+					fs->superBlock.block_refs[dst[b]-fs->superBlock.first_data_block]=0;
+				}
+				for(int c=0;c<=k;c++){
+					int blocks[FILE_BLOCKS], nrefs=0;
+					if(fs->superBlock.dedup && fs->inodes[tree[c]].type=='F'){//Only the references already taken are dropped
+						nrefs=fileBlocks(fs, tree[c], blocks);
+						if(c==k) nrefs=shared;
 					}
-					else {//Unknown file type.
-						printf("Unknown element type\n");
-						return -2;
+					for(int b=0;b<nrefs;b++){
+						fs->superBlock.block_refs[blocks[b]]--;
 					}
+					memset(&fs->inodes[copy[tree[c]]], 0, sizeof(struct inode));
 				}
+				return -2;
 			}
+		}
+	}
+	strcpy(fs->inodes[copy[i]].name, name);
+	fs->inodes[adv].contents[slot]=copy[i];
+	for(int k=0;k<count;k++){//The copies can be found once they have their final names
+		indexInode(fs, copy[tree[k]]);
+	}
+	for(int k=0;k<count;k++){//Each entry keeps its position in the contents of the copied directory
+		if(fs->inodes[tree[k]].type!='D') continue;
+		for(int c=0;c<10;c++){
+			if(fs->inodes[tree[k]].contents[c]){
+				fs->inodes[copy[tree[k]]].contents[c]=copy[fs->inodes[tree[k]].contents[c]];
+			}
+		}
+	}
+	fs->superBlock.num_items+=count;
 
-
-			return 0;
+	//The data blocks are copied with one batched read and one batched write
+	if(nblocks){
+		char *data=getBuffers(fs, nblocks);
+		if(!data || fs->dev->breadv(fs->image, src, nblocks, data)==-1 || fs->dev->bwritev(fs->image, dst, nblocks, data)==-1){
+			if(data) putBuffers(fs, data, nblocks);
+			printf("Error while writting\n");
+			return -2;
 		}
-		if(!strcmp(inodes[i].file_path, path)){//In the case of the ls being performed over a file path there is an error
-			printf("The path of the arguments is from a file. This path is required to be from a directory\n");
-			return -2; //The path is from a file not from a directory
+		putBuffers(fs, data, nblocks);
+	}
+	if(syncMetadata(fs)==-1){//And the metadata is written once
+		printf("Error while writting\n");
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Enables or disables the sharing of identical data blocks between files.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsSetDedupMode(fs_t *fs, int enabled)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -1;
+	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -1;
+	}
+	if(enabled && !fs->superBlock.dedup){//The index is rebuilt as blocks written without deduplication have no hash
+		char *block=getBuffers(fs, 1);
+		for(int n=0;n<NUM_INODES;n++){
+			if(bitmap_getbit(fs->superBlock.bitmap,n)){
+				if(!block || fs->dev->bread(fs->image, n+fs->superBlock.first_data_block, block)==-1){
+					if(block) putBuffers(fs, block, 1);
+					printf("Error while reading\n");
+					return -1;
+				}
+				fs->superBlock.block_hash[n]=blockHash(block, fs->dev->size);
+			}
 		}
+		if(block) putBuffers(fs, block, 1);
 	}
-		//directory does not exist
-		printf("The directory does not exist\n");
+	fs->superBlock.dedup=enabled ? 1 : 0;
+	if(syncMetadata(fs)==-1){
+		printf("Error while writting\n");
 		return -1;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Chooses between zeroing the freed data blocks at once or discarding them later.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsSetSecureErase(fs_t *fs, int enabled)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -1;
+	}
+	if(fs->snapshot_view!=-1){//Snapshots can only be read
+		printf("The file system is mounted read-only\n");
+		return -1;
+	}
+	fs->superBlock.secure_erase=enabled ? 1 : 0;
+	if(discardBlocks(fs)==-1 || writeSuperBlock(fs)==-1){//No freed block keeps its content after enabling it
+		printf("Error while writting\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Discards now the freed data blocks that are waiting, giving their space back to the host.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsDiscard(fs_t *fs)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -1;
+	}
+	if(discardBlocks(fs)==-1){
+		printf("Error while writting\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Enables or disables the access to the image with O_DIRECT, so blocks are only cached by the file system.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsSetDirectIO(fs_t *fs, int enabled)
+{
+	fs->direct=enabled ? 1 : 0;
+	if(fs->dev){//The block functions of a formatted or mounted file system are switched at once
+		fs->dev=deviceFor(fs, fs->dev->size);
+	}
+	return 0;
+}
+
+/*
+ * @brief	Enables or disables buffering the writes of each opened file, which are written when the file is closed or synced, when its buffer is full or once the oldest one is maxAgeMs old. The age is checked when the files are read, written, sought or closed, so a buffer can wait longer if none of them is called. A buffer that cannot be written is kept and written again later, and its file is not closed.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsSetWriteBehind(fs_t *fs, int enabled, int maxAgeMs)
+{
+	if(maxAgeMs<0){
+		printf("The age of the buffered writes cannot be negative\n");
+		return -1;
+	}
+	if(!enabled && fs->superBlock.mounted && flushWriteBuffers(fs, -1, 0)==-1){//Nothing stays buffered once it is disabled
+		printf("Error while writting\n");
+		return -1;
+	}
+	fs->write_behind=enabled ? 1 : 0;
+	fs->write_behind_age=maxAgeMs*1000000L;
+	return 0;
+}
+
+/*
+ * @brief	Sets how many block writes of a call are kept to be sorted and merged before they are submitted, 0 to submit each one at once.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsSetIoWindow(fs_t *fs, int requests)
+{
+	if(requests<0 || requests>QUEUE_DEPTH){
+		printf("The window must be between 0 and %d requests\n", QUEUE_DEPTH);
+		return -1;
+	}
+	fs->queue.window=requests;
+	return 0;
+}
+
+/*
+ * @brief	Computes the hash of the content of a data block.
+ * @return	The 32 bit FNV-1a hash of the block.
+ */
+unsigned int blockHash(char *block, int size)
+{
+	unsigned int hash=2166136261u;
+	for(int k=0;k<size;k++){
+		hash^=(unsigned char)block[k];
+		hash*=16777619u;
+	}
+	return hash;
+}
+
+/*
+ * @brief	Looks for a data block with the same content in the deduplication index.
+ * @return	The index of the data block if found, -1 otherwise.
+ */
+int dedupLookup(fs_t *fs, unsigned int hash, char *block)
+{
+	char *candidate=NULL;
+	int found=-1;
+	for(int n=0;found==-1 && n<NUM_INODES;n++){
+		if(bitmap_getbit(fs->superBlock.bitmap,n) && fs->superBlock.block_refs[n] && fs->superBlock.block_hash[n]==hash){
+			//Equal hashes are confirmed with the content in the disk to avoid collisions
+			if(!candidate && !(candidate=getBuffers(fs, 1))) break;
+			if(bqueueRead(&fs->queue, fs->dev, fs->image, n+fs->superBlock.first_data_block, candidate)==-1) break;
+			if(!memcmp(candidate, block, fs->dev->size)) found=n;
+		}
+	}
+	if(candidate) putBuffers(fs, candidate, 1);
+	return found;
+}
+
+/*
+ * @brief	Reserves the first free data block of the bitmap starting from goal, going back to the first one if needed.
+ * @return	The index of the data block if success, -1 otherwise.
+ */
+int allocDataBlock(fs_t *fs, int goal)
+{
+	int blocks=fs->superBlock.partitionBlocks-fs->superBlock.first_data_block;//To avoid creating a block outside the partition
+	if(blocks>NUM_INODES) blocks=NUM_INODES;
+	if(goal<0 || goal>=blocks) goal=0;
+	for(int k=0;k<blocks;k++){
+		int n=(goal+k)%blocks;
+		if(!bitmap_getbit(fs->superBlock.bitmap,n)){
+			bitmap_setbit(fs->superBlock.bitmap,n,1);//and we update the bitmap
+			fs->pending_discard&=~(1ull<<n);//It is going to be written, so it does not need to be discarded
+			fs->superBlock.block_refs[n]=1;
+			fs->superBlock.block_hash[n]=0;
+			return n;
+		}
+	}
+	return -1;
+}
+
+/*
+ * @brief	Chooses where block k of a file should go: after the previous block of the file or, for the first one, after the last block of the files of its directory, inside the block group of the file.
+ * @return	The index of the data block to start looking from.
+ */
+int allocGoal(fs_t *fs, int inode, int k)
+{
+	for(int b=k-1;b>=0;b--){
+		if(fs->inodes[inode].blocks[b]) return fs->inodes[inode].blocks[b]-fs->superBlock.first_data_block+1+(k-b-1);
+	}
+	int goal=groupFirstBlock(fs, inode/GROUP_INODES), dir=fs->inodes[inode].parent;
+	for(int c=0;c<10;c++){
+		int n=fs->inodes[dir].contents[c];
+		if(n && n!=inode && fs->inodes[n].type=='F'){
+			for(int b=0;b<FILE_BLOCKS;b++){
+				int next=fs->inodes[n].blocks[b]-fs->superBlock.first_data_block+1;
+				if(fs->inodes[n].blocks[b] && next>goal) goal=next;
+			}
+		}
+	}
+	return goal;
+}
+
+/*
+ * @brief	Chooses a free inode for a new file or directory. A file goes in the block group of its directory, a directory in the group with the most free inodes.
+ * @return	The index of the free inode, -1 if there is none.
+ */
+int allocInode(fs_t *fs, int parent, char type)
+{
+	int group=parent/GROUP_INODES;
+	if(type=='D'){//Spreading the directories leaves room in each group for the files they will hold
+		int most=-1;
+		for(int g=0;g<NUM_GROUPS;g++){
+			int free_inodes=0;
+			for(int i=g*GROUP_INODES;i<(g+1)*GROUP_INODES;i++) free_inodes+=!fs->inodes[i].type;
+			if(free_inodes>most) most=free_inodes, group=g;
+		}
+	}
+	for(int k=0;k<NUM_INODES;k++){//When the group is full the next ones are used
+		int i=(group*GROUP_INODES+k)%NUM_INODES;
+		if(!fs->inodes[i].type) return i;
+	}
+	return -1;
+}
+
+/*
+ * @brief	Computes the first data block of a block group, the data blocks of the partition are split evenly between the groups.
+ * @return	The index of the first data block of the group.
+ */
+int groupFirstBlock(fs_t *fs, int group)
+{
+	int blocks=fs->superBlock.partitionBlocks-fs->superBlock.first_data_block;
+	if(blocks>NUM_INODES) blocks=NUM_INODES;
+	return group*blocks/NUM_GROUPS;
+}
+
+/*
+ * @brief	Lists the data blocks of a file, without its holes.
+ * @return	The number of data block indexes copied into n.
+ */
+int fileBlocks(fs_t *fs, int inode, int *n)
+{
+	int count=0;
+	for(int k=0;k<FILE_BLOCKS;k++){
+		if(fs->inodes[inode].blocks[k]) n[count++]=fs->inodes[inode].blocks[k]-fs->superBlock.first_data_block;
+	}
+	return count;
+}
+
+/*
+ * @brief	Chooses the block functions for a block size, with O_DIRECT if the handle asks for it.
+ * @return	The block functions, NULL if the block size is not supported.
+ */
+const struct blockDevice *deviceFor(fs_t *fs, int blockSize)
+{
+	return fs->direct ? blockDeviceDirect(blockSize) : blockDeviceFor(blockSize);
+}
+
+/*
+ * @brief	Allocates the aligned buffer pool for the block size of the file system, keeping it if it already fits. The slots of the request queue are allocated with it.
+ * @return	0 if success, -1 otherwise.
+ */
+int initBufferPool(fs_t *fs)
+{
+	releaseTails(fs, -1);//The tail blocks and the write buffers are the only buffers kept between calls
+	releaseWriteBuffers(fs, -1);
+	if(fs->pool && fs->pool_block_size==fs->dev->size) return 0;
+	freeBufferPool(fs);
+	if(posix_memalign((void **)&fs->pool, DIRECT_ALIGN, (size_t)(POOL_BUFFERS+QUEUE_DEPTH)*fs->dev->size)!=0){
+		fs->pool=NULL;
+		return -1;
+	}
+	fs->pool_block_size=fs->dev->size;
+	fs->queue.slots=fs->pool+(size_t)POOL_BUFFERS*fs->dev->size;
+	return 0;
+}
+
+/*
+ * @brief	Releases the buffer pool, and the tail blocks taken from it.
+ */
+void freeBufferPool(fs_t *fs)
+{
+	releaseTails(fs, -1);
+	releaseWriteBuffers(fs, -1);
+	free(fs->pool);
+	fs->pool=NULL;
+	fs->queue.slots=NULL;
+	bzero(fs->pool_used, sizeof(fs->pool_used));
+}
+
+/*
+ * @brief	Takes count consecutive block buffers from the pool.
+ * @return	The first buffer if success, NULL otherwise.
+ */
+char *getBuffers(fs_t *fs, int count)
+{
+	for(int k=0, run=0;fs->pool && k<POOL_BUFFERS;k++){
+		run=fs->pool_used[k] ? 0 : run+1;
+		if(run==count){
+			memset(fs->pool_used+k-count+1, 1, count);
+			return fs->pool+(size_t)(k-count+1)*fs->pool_block_size;
+		}
+	}
+	printf("No free block buffers\n");
+	return NULL;
+}
+
+/*
+ * @brief	Gives back count block buffers taken with getBuffers.
+ */
+void putBuffers(fs_t *fs, char *buffers, int count)
+{
+	memset(fs->pool_used+(buffers-fs->pool)/fs->pool_block_size, 0, count);
+}
+
+/*
+ * @brief	Looks for the write buffer of a file.
+ * @return	The index of the buffer, -1 if the file has none.
+ */
+int findWriteBuffer(fs_t *fs, int inode)
+{
+	for(int w=0;w<MAX_WRITE_BUFFERS;w++){
+		if(fs->write_buffers[w].used && fs->write_buffers[w].inode==inode) return w;
+	}
+	return -1;
+}
+
+/*
+ * @brief	Writes the blocks held by a write buffer, with the metadata once at the end, and empties it.
+ * @return	0 if success, -1 otherwise.
+ */
+int flushWriteBuffer(fs_t *fs, int w)
+{
+	struct writeBuffer *wb=&fs->write_buffers[w];
+	int dirty=0, ret=0, written=0;
+	bplug(&fs->queue);//The blocks are submitted sorted, with the metadata
+	for(;written<wb->count;written++){
+		int wrote=dedupWrite(fs, wb->inode, wb->index[written], wb->blocks[written]);
+		if(wrote==-1){
+			ret=-1;
+			break;
+		}
+		dirty|=wrote;
+	}
+	//The blocks already written are kept in the metadata even after an error, and the length grown with them in the inode
+	if(dirty ? syncMetadata(fs)==-1 : writeInodes(fs)==-1) ret=-1;
+	if(bunplug(&fs->queue, fs->dev, fs->image)==-1){//Nothing is known to be in the disk, so every block is written again next time
+		ret=-1;
+		written=0;
+	}
+	//Only the written blocks leave the buffer, the rest wait for the next flush
+	for(int b=0;b<written;b++){
+		putBuffers(fs, wb->blocks[b], 1);
+	}
+	for(int b=written;b<wb->count;b++){
+		wb->index[b-written]=wb->index[b];
+		wb->blocks[b-written]=wb->blocks[b];
+	}
+	wb->count-=written;
+	return ret;
+}
+
+/*
+ * @brief	Flushes the write buffers of a file, or of all of them if inode is -1, whose oldest write is at least age nanoseconds old.
+ * @return	0 if success, -1 otherwise.
+ */
+int flushWriteBuffers(fs_t *fs, int inode, long age)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	long now=ts.tv_sec*1000000000L+ts.tv_nsec;
+	int ret=0;
+	for(int w=0;w<MAX_WRITE_BUFFERS;w++){
+		struct writeBuffer *wb=&fs->write_buffers[w];
+		if(!wb->used || !wb->count || (inode!=-1 && wb->inode!=inode) || now-wb->since<age) continue;
+		if(flushWriteBuffer(fs, w)==-1) ret=-1;
+	}
+	return ret;
+}
+
+/*
+ * @brief	Releases the write buffers without writing them, or only the one of a file if inode is not -1.
+ */
+void releaseWriteBuffers(fs_t *fs, int inode)
+{
+	for(int w=0;w<MAX_WRITE_BUFFERS;w++){
+		struct writeBuffer *wb=&fs->write_buffers[w];
+		if(!wb->used || (inode!=-1 && wb->inode!=inode)) continue;
+		for(int b=0;b<wb->count;b++){
+			putBuffers(fs, wb->blocks[b], 1);
+		}
+		wb->count=0;
+		wb->used=0;
+	}
+}
+
+/*
+ * @brief	Copies bytes into the write buffer of a file at its seek pointer, reading first the blocks that are partially written.
+ * @return	Number of bytes buffered, -2 in case of error.
+ */
+int bufferedWrite(fs_t *fs, int i, char *buffer, int numBytes)
+{
+	int w=findWriteBuffer(fs, i);
+	if(w==-1){//The file takes a free buffer, or the one with the oldest writes after flushing it
+		for(int v=0;v<MAX_WRITE_BUFFERS;v++){
+			if(!fs->write_buffers[v].used){
+				w=v;
+				break;
+			}
+			if(w==-1 || fs->write_buffers[v].since<fs->write_buffers[w].since) w=v;
+		}
+		if(fs->write_buffers[w].used){
+			int ret=flushWriteBuffer(fs, w);
+			releaseWriteBuffers(fs, fs->write_buffers[w].inode);
+			if(ret==-1){
+				printf("Error while writting\n");
+				return -2;
+			}
+		}
+		fs->write_buffers[w].used=1;
+		fs->write_buffers[w].inode=i;
+	}
+	struct writeBuffer *wb=&fs->write_buffers[w];
+
+	for(int done=0;done<numBytes;){
+		int k=(fs->inodes[i].seek_ptr+done)/fs->dev->size, offset=(fs->inodes[i].seek_ptr+done)%fs->dev->size;
+		int count=fs->dev->size-offset<numBytes-done ? fs->dev->size-offset : numBytes-done;
+		int b;
+		for(b=0;b<wb->count && wb->index[b]!=k;b++);
+		if(b==wb->count){//The block is not buffered yet
+			if(wb->count==WRITE_BUFFER_BLOCKS && flushWriteBuffer(fs, w)==-1){//The full buffer is written to make room
+				printf("Error while writting\n");
+				return -2;
+			}
+			if(!wb->count){
+				struct timespec ts;
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				wb->since=ts.tv_sec*1000000000L+ts.tv_nsec;
+			}
+			b=wb->count;
+			char *block=getBuffers(fs, 1);
+			if(!block){
+				printf("Error while writting\n");
+				return -2;
+			}
+			bzero(block, fs->dev->size);
+			if(fs->inodes[i].blocks[k] && count<fs->dev->size && bqueueRead(&fs->queue, fs->dev, fs->image, fs->inodes[i].blocks[k], block)==-1){
+				putBuffers(fs, block, 1);
+				printf("Error while reading\n");
+				return -2;
+			}
+			wb->index[b]=k;
+			wb->blocks[b]=block;
+			wb->count++;
+		}
+		memcpy(wb->blocks[b]+offset, buffer+done, count);
+		done+=count;
+	}
+	fs->inodes[i].seek_ptr+=numBytes;
+	if(fs->inodes[i].seek_ptr>fs->inodes[i].size) fs->inodes[i].size=fs->inodes[i].seek_ptr;//Written with the blocks
+	return numBytes;
+}
+
+/*
+ * @brief	Looks for the append slot of a file.
+ * @return	The index of the slot, -1 if the file is not opened in append mode.
+ */
+int findTail(fs_t *fs, int inode)
+{
+	for(int t=0;t<MAX_APPENDERS;t++){
+		if(fs->tails[t].used && fs->tails[t].inode==inode) return t;
+	}
+	return -1;
+}
+
+/*
+ * @brief	Loads the block that holds the tail of an append slot, with the bytes after the tail cleared.
+ * @return	0 if success, -1 otherwise.
+ */
+int loadTail(fs_t *fs, int t)
+{
+	struct appendTail *tail=&fs->tails[t];
+	int k=tail->tail/fs->dev->size, offset=tail->tail%fs->dev->size;
+	bzero(tail->block, fs->dev->size);
+	if(offset && fs->inodes[tail->inode].blocks[k]){
+		if(fs->dev->bread(fs->image, fs->inodes[tail->inode].blocks[k], tail->block)==-1) return -1;
+		memset(tail->block+offset, 0, fs->dev->size-offset);
+	}
+	return 0;
+}
+
+/*
+ * @brief	Releases the append slots, or only the one of a file if inode is not -1.
+ */
+void releaseTails(fs_t *fs, int inode)
+{
+	for(int t=0;t<MAX_APPENDERS;t++){
+		if(fs->tails[t].used && (inode==-1 || fs->tails[t].inode==inode)){
+			putBuffers(fs, fs->tails[t].block, 1);
+			fs->tails[t].block=NULL;
+			fs->tails[t].used=0;
+		}
+	}
+}
+
+/*
+ * @brief	Appends bytes at the tail of a file opened in append mode, writing each touched block once from the copy kept in memory.
+ * @return	Number of bytes appended, -2 in case of error.
+ */
+int appendWrite(fs_t *fs, int t, char *buffer, int numBytes)
+{
+	struct appendTail *tail=&fs->tails[t];
+	int i=tail->inode, max_size=FILE_BLOCKS*fs->dev->size;
+	pthread_mutex_lock(&fs->append_lock);//The tail is reserved, written and moved by one appender at a time
+	if(numBytes>max_size-tail->tail){//We make sure it does not write outside the file
+		numBytes=max_size-tail->tail;
+	}
+
+	int dirty=0;
+	bplug(&fs->queue);
+	for(int done=0;done<numBytes;){
+		int k=(tail->tail+done)/fs->dev->size, offset=(tail->tail+done)%fs->dev->size;
+		int count=fs->dev->size-offset<numBytes-done ? fs->dev->size-offset : numBytes-done;
+		if(!offset) bzero(tail->block, fs->dev->size);//A new block starts empty, the full one is not needed anymore
+		memcpy(tail->block+offset, buffer+done, count);
+
+		int ret=dedupWrite(fs, i, k, tail->block);//The block is written once, without reading it first
+		if(ret==-1){//The tail does not move, so the next append overwrites what was written
+			if(dirty) syncMetadata(fs);
+			bunplug(&fs->queue, fs->dev, fs->image);
+			loadTail(fs, t);
+			pthread_mutex_unlock(&fs->append_lock);
+			printf("Error while writting\n");
+			return -2;
+		}
+		dirty|=ret;
+		done+=count;
+	}
+	int size=fs->inodes[i].size;
+	fs->inodes[i].size=tail->tail+numBytes;//Every append moves the end of the file, so the inode is always written
+	int ret=dirty ? syncMetadata(fs) : numBytes ? writeInodes(fs) : 0;
+	if(bunplug(&fs->queue, fs->dev, fs->image)==-1 || ret==-1){
+		fs->inodes[i].size=size;
+		loadTail(fs, t);
+		pthread_mutex_unlock(&fs->append_lock);
+		printf("Error while writting\n");
+		return -2;
+	}
+	//The tail moves once the whole append is in the disk
+	tail->tail+=numBytes;
+	fs->inodes[i].seek_ptr=tail->tail;
+	pthread_mutex_unlock(&fs->append_lock);
+	return numBytes;
+}
+
+/*
+ * @brief	Drops a reference to a data block, freeing it when no file uses it anymore.
+ * @return	0 if success, -1 otherwise.
+ */
+int releaseDataBlock(fs_t *fs, int n)
+{
+	return releaseDataBlocks(fs, &n, 1);
+}
+
+/*
+ * @brief	Drops a reference to each of count data blocks. The ones no file uses anymore are queued to be discarded, or zeroed at once with secure erase.
+ * @return	0 if success, -1 otherwise.
+ */
+int releaseDataBlocks(fs_t *fs, int *n, int count)
+{
+	int freed[NUM_INODES], nfreed=0;
+	for(int k=0;k<count;k++){
+		if(fs->superBlock.block_refs[n[k]]>1){//Other files still share the block
+			fs->superBlock.block_refs[n[k]]--;
+			continue;
+		}
+		fs->superBlock.block_refs[n[k]]=0;
+		fs->superBlock.block_hash[n[k]]=0;
+		bitmap_setbit(fs->superBlock.bitmap,n[k],0);
+		freed[nfreed++]=n[k]+fs->superBlock.first_data_block;
+		fs->pending_discard|=1ull<<n[k];
+	}
+	if(!nfreed) return 0;
+	if(!fs->superBlock.secure_erase){//The blocks are discarded later, several at once
+		return __builtin_popcountll(fs->pending_discard)>=DISCARD_BATCH ? discardBlocks(fs) : 0;
+	}
+
+	//With secure erase we delete the data blocks now
+	for(int k=0;k<nfreed;k++) fs->pending_discard&=~(1ull<<(freed[k]-fs->superBlock.first_data_block));
+	char *resetFileblocks=getBuffers(fs, nfreed);
+	if(!resetFileblocks) return -1;
+	bzero(resetFileblocks, (size_t)nfreed*fs->dev->size);
+	int ret=fs->dev->bwritev(fs->image, freed, nfreed, resetFileblocks);
+	putBuffers(fs, resetFileblocks, nfreed);
+	return ret;
+}
+
+/*
+ * @brief	Punches holes in the image for the freed data blocks that are waiting to be discarded.
+ * @return	0 if success, -1 otherwise.
+ */
+int discardBlocks(fs_t *fs)
+{
+	int blocks[NUM_INODES], count=0;
+	for(int n=0;n<NUM_INODES;n++){
+		if(fs->pending_discard & (1ull<<n)) blocks[count++]=n+fs->superBlock.first_data_block;
+	}
+	if(!count) return 0;
+	if(fs->dev->bdiscardv(fs->image, blocks, count)==-1) return -1;
+	fs->pending_discard=0;
+	return 0;
+}
+
+/*
+ * @brief	Writes block k of a file, sharing or copying its data block if deduplication is on. Blocks of zeros stay as holes.
+ * @return	1 if the metadata changed and has to be written, 0 if it did not, -1 in case of error.
+ */
+int dedupWrite(fs_t *fs, int inode, int k, char *block)
+{
+	int old=fs->inodes[inode].blocks[k] ? fs->inodes[inode].blocks[k]-fs->superBlock.first_data_block : -1, n=-1;
+	if(old==-1){//Writing zeros in a hole leaves it as a hole
+		int zeros=1;
+		for(int b=0;zeros && b<fs->dev->size;b++) zeros=!block[b];
+		if(zeros) return 0;
+	}
+	unsigned int hash=blockHash(block, fs->dev->size);
+
+	if(fs->superBlock.dedup){
+		n=dedupLookup(fs, hash, block);
+	}
+	if(n!=-1 && n==old){//The content did not change so there is nothing to write
+		return 0;
+	}
+	if(n!=-1 && fs->superBlock.block_refs[n]<255){//Another block has the same content so we just point to it
+		fs->superBlock.block_refs[n]++;
+		fs->inodes[inode].blocks[k]=n+fs->superBlock.first_data_block;
+		if(old!=-1 && releaseDataBlock(fs, old)==-1) return -1;
+		return 1;
+	}
+
+	if(old==-1){//The first write of the block is when it is chosen
+		if((n=allocDataBlock(fs, allocGoal(fs, inode, k)))==-1) return -1;
+		fs->inodes[inode].blocks[k]=n+fs->superBlock.first_data_block;
+	}
+	else if(fs->superBlock.block_refs[old]>1){//The block is shared, so it is copied before being modified
+		if((n=allocDataBlock(fs, old+1))==-1) return -1;
+		fs->superBlock.block_refs[old]--;
+		fs->inodes[inode].blocks[k]=n+fs->superBlock.first_data_block;
+	}
+	else{
+		n=old;
+	}
+	if(bqueueWrite(&fs->queue, fs->dev, fs->image, n+fs->superBlock.first_data_block, block)==-1) return -1;
+	fs->superBlock.block_hash[n]=hash;
+
+	return n!=old;
+}
+
+/*
+ * @brief	Writes the inode blocks and the superblock to the disk.
+ * @return	0 if success, -1 otherwise.
+ */
+int syncMetadata(fs_t *fs)
+{
+	bplug(&fs->queue);//The superblock goes with the inode blocks after it in one request
+	int ret=writeInodes(fs)==-1 || writeSuperBlock(fs)==-1 ? -1 : 0;
+	if(bunplug(&fs->queue, fs->dev, fs->image)==-1){
+		bzero(fs->disk_inodes, sizeof(fs->disk_inodes));//The inode blocks may not be in the disk, so they are written again next time
+		ret=-1;
+	}
+	return ret;
+}
+
+/*
+ * @brief	Writes the modified inodes to the inode blocks of the disk.
+ * @return	0 if success, -1 otherwise.
+ */
+int writeInodes(fs_t *fs)
+{
+	EVENT_BEGIN(EVENT_INODE_FLUSH, 0);
+	int inodes_per_block=fs->dev->size/sizeof(struct inode);
+	char *inode_block=getBuffers(fs, 1);
+	if(!inode_block){
+		EVENT_END(EVENT_INODE_FLUSH, -1);
+		return -1;
+	}
+	bplug(&fs->queue);//The modified inode blocks are written together, the consecutive ones in a single request
+	for(int x=1, cur_inode=0; x<fs->superBlock.first_data_block; x++, cur_inode+=inodes_per_block){//For the blocks of inodes
+		int count=NUM_INODES-cur_inode<inodes_per_block ? NUM_INODES-cur_inode : inodes_per_block;
+		//Blocks whose inodes did not change since they were last written (or never used) are skipped, opening or seeking a file does not count
+		packInodeBlock(fs, x, inode_block);
+		if(!memcmp(inode_block, &fs->disk_inodes[cur_inode], count*sizeof(struct inode))) continue;
+
+		if(bqueueWrite(&fs->queue, fs->dev, fs->image, x, inode_block)==-1){
+			bunplug(&fs->queue, fs->dev, fs->image);
+			bzero(fs->disk_inodes, sizeof(fs->disk_inodes));
+			putBuffers(fs, inode_block, 1);
+			EVENT_END(EVENT_INODE_FLUSH, -1);
+			return -1;
+		}
+		memcpy(&fs->disk_inodes[cur_inode], inode_block, count*sizeof(struct inode));
+		fs->superBlock.initialized_inode_blocks|=1u<<(x-1);
+	}
+	putBuffers(fs, inode_block, 1);
+	if(bunplug(&fs->queue, fs->dev, fs->image)==-1){
+		bzero(fs->disk_inodes, sizeof(fs->disk_inodes));
+		EVENT_END(EVENT_INODE_FLUSH, -1);
+		return -1;
+	}
+	statsInodeFlush();
+	EVENT_END(EVENT_INODE_FLUSH, 0);
+	return 0;
+}
+
+/*
+ * @brief	Fills block with the inodes that go in the inode block x, as they are stored in the device: the files are closed and at their beginning.
+ */
+void packInodeBlock(fs_t *fs, int x, char *block)
+{
+	int inodes_per_block=fs->dev->size/sizeof(struct inode), first=(x-1)*inodes_per_block;
+	int count=NUM_INODES-first<inodes_per_block ? NUM_INODES-first : inodes_per_block;
+	struct inode *packed=(struct inode *)block;
+	bzero(block, fs->dev->size);
+	memcpy(block, &fs->inodes[first], count*sizeof(struct inode));
+	for(int i=0;i<count;i++){//The state of the opened files only lives in memory
+		if(packed[i].type!='F') continue;
+		packed[i].opened='N';
+		packed[i].seek_ptr=0;
+	}
+}
+
+/*
+ * @brief	Reads the inodes from the inode blocks of the disk, the blocks not initialized yet are empty.
+ * @return	0 if success, -1 otherwise.
+ */
+int readInodes(fs_t *fs)
+{
+	int inodes_per_block=fs->dev->size/sizeof(struct inode);
+	bzero(fs->disk_inodes, sizeof(fs->disk_inodes));
+	char *inode_block=getBuffers(fs, 1);
+	if(!inode_block) return -1;
+	for(int x=1, cur_inode=0; x<fs->superBlock.first_data_block; x++, cur_inode+=inodes_per_block){
+		if(!(fs->superBlock.initialized_inode_blocks & (1u<<(x-1)))) continue;
+
+		int count=NUM_INODES-cur_inode<inodes_per_block ? NUM_INODES-cur_inode : inodes_per_block;
+		if(fs->dev->bread(fs->image, x, inode_block)==-1){
+			putBuffers(fs, inode_block, 1);
+			return -1;
+		}
+		memcpy(&fs->disk_inodes[cur_inode], inode_block, count*sizeof(struct inode));
+	}
+	putBuffers(fs, inode_block, 1);
+	memcpy(fs->inodes, fs->disk_inodes, sizeof(fs->inodes));
+
+	if(!(fs->superBlock.initialized_inode_blocks & 1u)){//The root directory has not been written yet
+		fs->inodes[0].type='D';
+	}
+	indexInodes(fs);
+	for(int i=0;i<NUM_INODES;i++){//No file is opened after mounting
+		if(fs->inodes[i].type=='F'){
+			fs->inodes[i].opened='N';
+			fs->inodes[i].seek_ptr=0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * @brief	Writes the superblock to the disk.
+ * @return	0 if success, -1 otherwise.
+ */
+int writeSuperBlock(fs_t *fs)
+{
+	EVENT_BEGIN(EVENT_SUPERBLOCK_FLUSH, 0);
+	char *supblock=getBuffers(fs, 1);
+	if(!supblock){
+		EVENT_END(EVENT_SUPERBLOCK_FLUSH, -1);
+		return -1;
+	}
+	bzero(supblock, fs->dev->size);
+	memcpy(supblock,&fs->superBlock, sizeof(struct sBlock));
+	int ret=bqueueWrite(&fs->queue, fs->dev, fs->image, 0, supblock);
+	putBuffers(fs, supblock, 1);
+	if(ret==0) statsSuperBlockFlush();
+	EVENT_END(EVENT_SUPERBLOCK_FLUSH, ret);
+	return ret;
+}
+
+/*
+ * @brief	Records the name hash and the parent of an inode in the name lookup index, a free inode matches no lookup.
+ */
+void indexInode(fs_t *fs, int i)
+{
+	if(!i || !fs->inodes[i].type){//The root is the entry of no directory
+		fs->names.hash[i]=0;
+		fs->names.parent[i]=-1;
+		return;
+	}
+	fs->names.hash[i]=blockHash(fs->inodes[i].name, strlen(fs->inodes[i].name));
+	fs->names.parent[i]=fs->inodes[i].parent;
+}
+
+/*
+ * @brief	Rebuilds the name lookup index from all the inodes.
+ */
+void indexInodes(fs_t *fs)
+{
+	for(int i=0;i<NUM_INODES;i++){
+		indexInode(fs, i);
+	}
+}
+
+/*
+ * @brief	Looks for the entry of a directory with the given name in the name lookup index. The hashes and parents of several inodes are compared at once and only the names that match are compared.
+ *		The widest vectors the compiler is allowed to use are chosen, and FS_SCALAR compares one inode at a time.
+ * @return	The index of the inode of the entry, -1 if there is none.
+ */
+int findEntry(fs_t *fs, int dir, char *name)
+{
+	unsigned int hash=blockHash(name, strlen(name));
+#if defined(__AVX2__) && !defined(FS_SCALAR)
+	__m256i h=_mm256_set1_epi32((int)hash), d=_mm256_set1_epi32(dir);
+	for(int i=0;i<NUM_INODES;i+=8){
+		__m256i eq=_mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *)&fs->names.hash[i]), h),
+			_mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *)&fs->names.parent[i]), d));
+		for(int mask=_mm256_movemask_ps(_mm256_castsi256_ps(eq));mask;mask&=mask-1){
+			int n=i+__builtin_ctz(mask);
+			if(!strcmp(fs->inodes[n].name, name)) return n;
+		}
+	}
+#elif defined(__SSE2__) && !defined(FS_SCALAR)
+	__m128i h=_mm_set1_epi32((int)hash), d=_mm_set1_epi32(dir);
+	for(int i=0;i<NUM_INODES;i+=4){
+		__m128i eq=_mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)&fs->names.hash[i]), h),
+			_mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)&fs->names.parent[i]), d));
+		for(int mask=_mm_movemask_ps(_mm_castsi128_ps(eq));mask;mask&=mask-1){
+			int n=i+__builtin_ctz(mask);
+			if(!strcmp(fs->inodes[n].name, name)) return n;
+		}
+	}
+#else
+	for(int n=0;n<NUM_INODES;n++){
+		if(fs->names.hash[n]==hash && fs->names.parent[n]==dir && !strcmp(fs->inodes[n].name, name)) return n;
+	}
+#endif
+	return -1;
+}
+
+/*
+ * @brief	Looks for a free entry in the contents of a directory.
+ * @return	The position of the entry, -1 if the directory is full.
+ */
+int freeEntry(fs_t *fs, int dir)
+{
+	for(int k=0;k<10;k++){
+		if(!fs->inodes[dir].contents[k]) return k;
+	}
+	return -1;
+}
+
+/*
+ * @brief	Follows a path from the root, one name at a time. Paths of directories end in '/'.
+ * @return	The index of the inode of the path, -1 if it does not exist.
+ */
+int lookupPath(fs_t *fs, char *path)
+{
+	if(path[0]!='/') return -1;
+	int n=0;//We start from the root
+	char *name=path+1;
+	while(*name){
+		char *end=strchr(name, '/');
+		int len=end ? end-name : (int)strlen(name);
+		if(len==0 || len>32) return -1;
+
+		char component[33];
+		memcpy(component, name, len);
+		component[len]='\0';
+		n=findEntry(fs, n, component);
+		if(n==-1) return -1;
+		if(!end) return fs->inodes[n].type=='F' ? n : -1;//The last name of a file has no '/'
+		if(fs->inodes[n].type!='D') return -1;
+		name=end+1;
+	}
+	return n;
+}
+
+/*
+ * @brief	Finds the directory that contains a path and copies the last name of the path, without its '/'.
+ * @return	The index of the inode of the directory, -1 if it does not exist, -2 if the name is too long or empty.
+ */
+int lookupParent(fs_t *fs, char *path, char name[33])
+{
+	int len=strlen(path);
+	if(len && path[len-1]=='/') len--;//The '/' of a directory is not part of its name
+	int begin=len;
+	while(begin>0 && path[begin-1]!='/') begin--;
+	if(begin==0) return -1;
+	if(len-begin==0 || len-begin>32) return -2;
+
+	memcpy(name, path+begin, len-begin);
+	name[len-begin]='\0';
+	char dir[begin+1];
+	memcpy(dir, path, begin);
+	dir[begin]='\0';
+	int n=lookupPath(fs, dir);
+	return n!=-1 && fs->inodes[n].type=='D' ? n : -1;
+}
+
+/*
+ * @brief	Computes how many levels of directories there are below a directory.
+ * @return	0 for files and empty directories, the number of levels otherwise.
+ */
+int treeHeight(fs_t *fs, int n)
+{
+	int height=0;
+	if(fs->inodes[n].type!='D') return 0;
+	for(int k=0;k<10;k++){
+		int child=fs->inodes[n].contents[k];
+		if(child && fs->inodes[child].type=='D' && treeHeight(fs, child)+1>height){
+			height=treeHeight(fs, child)+1;
+		}
+	}
+	return height;
+}
+
+/*
+ * @brief	Lists an inode and everything below it, every directory before its contents.
+ * @return	The number of inodes copied into tree.
+ */
+int collectTree(fs_t *fs, int n, int tree[40])
+{
+	int count=0;
+	tree[count++]=n;
+	for(int k=0;k<count;k++){//The list itself is the queue of the directories to visit
+		if(fs->inodes[tree[k]].type!='D') continue;
+		for(int c=0;c<10;c++){
+			if(fs->inodes[tree[k]].contents[c]) tree[count++]=fs->inodes[tree[k]].contents[c];
+		}
+	}
+	return count;
+}
+
+/*
+ * @brief	Computes how many data blocks hold the record of a snapshot with the block size of the file system.
+ * @return	The number of data blocks.
+ */
+int snapshotBlocks(fs_t *fs)
+{
+	return (sizeof(struct snapshot)+fs->dev->size-1)/fs->dev->size;
+}
+
+/*
+ * @brief	Reads the records of the snapshots listed in the superblock.
+ * @return	0 if success, -1 otherwise.
+ */
+int readSnapshots(fs_t *fs)
+{
+	int count=snapshotBlocks(fs);
+	bzero(fs->snapshots, sizeof(fs->snapshots));
+	bzero(fs->snapshot_views, sizeof(fs->snapshot_views));
+	for(int s=0;s<MAX_SNAPSHOTS;s++){
+		if(!fs->superBlock.snapshot_blocks[s][0]) continue;//Free slot
+		char *record=getBuffers(fs, count);
+		if(!record) return -1;
+		if(fs->dev->breadv(fs->image, fs->superBlock.snapshot_blocks[s], count, record)==-1){
+			putBuffers(fs, record, count);
+			return -1;
+		}
+		memcpy(&fs->snapshots[s], record, sizeof(struct snapshot));
+		putBuffers(fs, record, count);
+	}
+	return 0;
+}
+
+/*
+ * @brief	Freezes the current inodes and bitmap under a name, sharing all the data blocks. The snapshot is stored in the device.
+ * @return	0 if success, -1 if the snapshot already exists, -2 in case of error.
+ */
+int fsCreateSnapshot(fs_t *fs, char *name)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -2;
+	}
+	if(fs->snapshot_view!=-1){
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
+	if(strlen(name)>32){
+		printf("Name of the snapshot too long, it must have under 32 characters\n");
+		return -2;
+	}
+	int s, free_slot=-1;
+	for(s=0;s<MAX_SNAPSHOTS;s++){
+		if(fs->snapshots[s].used && !strcmp(fs->snapshots[s].name, name)){
+			printf("The snapshot already exists\n");
+			return -1;
+		}
+		if(!fs->snapshots[s].used && free_slot==-1) free_slot=s;
+	}
+	if(free_slot==-1){
+		printf("There are too many snapshots\n");
+		return -2;
+	}
+	if(flushWriteBuffers(fs, -1, 0)==-1){//The snapshot keeps the buffered writes too
+		printf("Error while writting\n");
+		return -2;
+	}
+
+	//The record of the snapshot goes to data blocks of its own, pointed to by the superblock
+	int count=snapshotBlocks(fs), *record_blocks=fs->superBlock.snapshot_blocks[free_slot];
+	for(int k=0;k<count;k++){
+		int n=allocDataBlock(fs, k ? record_blocks[k-1]-fs->superBlock.first_data_block+1 : 0);
+		if(n==-1){
+			for(int j=0;j<k;j++) releaseDataBlock(fs, record_blocks[j]-fs->superBlock.first_data_block);
+			bzero(record_blocks, SNAPSHOT_BLOCKS*sizeof(int));
+			printf("There is not enough space for the snapshot\n");
+			return -2;
+		}
+		record_blocks[k]=n+fs->superBlock.first_data_block;
+	}
+
+	//Only the metadata is copied, the data blocks get one more reference so they are copied when modified
+	struct snapshot *snap=&fs->snapshots[free_slot];
+	memcpy(snap->inodes, fs->inodes, sizeof(fs->inodes));
+	memcpy(snap->bitmap, fs->superBlock.bitmap, sizeof(fs->superBlock.bitmap));
+	for(int k=0;k<count;k++){//The record itself is not part of the snapshot
+		bitmap_setbit(snap->bitmap, record_blocks[k]-fs->superBlock.first_data_block, 0);
+	}
+	for(int i=0;i<NUM_INODES;i++){
+		if(snap->inodes[i].type!='F') continue;
+		snap->inodes[i].opened='N';
+		snap->inodes[i].seek_ptr=0;
+	}
+	for(int n=0;n<NUM_INODES;n++){
+		if(bitmap_getbit(snap->bitmap,n)) fs->superBlock.block_refs[n]++;
+	}
+	strcpy(snap->name, name);
+	snap->used=1;
+
+	char *record=getBuffers(fs, count);
+	if(!record){
+		printf("Error while writting\n");
+		return -2;
+	}
+	bzero(record, (size_t)count*fs->dev->size);
+	memcpy(record, snap, sizeof(struct snapshot));
+	bplug(&fs->queue);//The record and the superblock pointing to it go in the same request
+	int ret=0;
+	for(int k=0;k<count && ret==0;k++){
+		ret=bqueueWrite(&fs->queue, fs->dev, fs->image, record_blocks[k], record+(size_t)k*fs->dev->size);
+	}
+	putBuffers(fs, record, count);
+	if(syncMetadata(fs)==-1) ret=-1;
+	if(bunplug(&fs->queue, fs->dev, fs->image)==-1 || ret==-1){
+		printf("Error while writting\n");
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Deletes a snapshot, releasing its record and the data blocks only it was using.
+ * @return	0 if success, -1 if the snapshot does not exist, -2 in case of error.
+ */
+int fsDeleteSnapshot(fs_t *fs, char *name)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -2;
+	}
+	if(fs->snapshot_view!=-1){
+		printf("The file system is mounted read-only\n");
+		return -2;
+	}
+	for(int s=0;s<MAX_SNAPSHOTS;s++){
+		if(fs->snapshots[s].used && !strcmp(fs->snapshots[s].name, name)){
+			if(fs->snapshot_views[s]){
+				printf("The snapshot is opened so it cannot be deleted.\n");
+				return -2;
+			}
+			int blocks[NUM_INODES+SNAPSHOT_BLOCKS], count=0;
+			for(int n=0;n<NUM_INODES;n++){
+				if(bitmap_getbit(fs->snapshots[s].bitmap,n)) blocks[count++]=n;
+			}
+			for(int k=0;k<snapshotBlocks(fs);k++){
+				blocks[count++]=fs->superBlock.snapshot_blocks[s][k]-fs->superBlock.first_data_block;
+			}
+			bzero(fs->superBlock.snapshot_blocks[s], sizeof(fs->superBlock.snapshot_blocks[s]));
+			memset(&fs->snapshots[s], 0, sizeof(struct snapshot));
+			if(releaseDataBlocks(fs, blocks, count)==-1 || syncMetadata(fs)==-1){
+				printf("Error while writting\n");
+				return -2;
+			}
+			return 0;
+		}
+	}
+	printf("The snapshot does not exist\n");
+	return -1;
+}
+
+/*
+ * @brief	Opens a snapshot read-only in a handle of its own, so the file system stays writable while it is read. The handle is released with fsClose.
+ * @return	The handle of the snapshot if success, NULL otherwise.
+ */
+fs_t *fsOpenSnapshot(fs_t *fs, char *name)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return NULL;
+	}
+	if(fs->snapshot_view!=-1){
+		printf("The file system is a snapshot already\n");
+		return NULL;
+	}
+	if(flushWriteBuffers(fs, -1, 0)==-1){//The view reads the device, so nothing can be left in memory
+		printf("Error while writting\n");
+		return NULL;
+	}
+	int s;
+	for(s=0;s<MAX_SNAPSHOTS && !(fs->snapshots[s].used && !strcmp(fs->snapshots[s].name, name));s++);
+	if(s==MAX_SNAPSHOTS){
+		printf("The snapshot does not exist\n");
+		return NULL;
+	}
+	fs_t *view=fsOpen(fs->image);
+	if(!view) return NULL;
+	//The blocks of a snapshot are copied before being modified, so the view reads them from the device while the file system writes
+	view->dev=fs->dev;
+	view->direct=fs->direct;
+	if(initBufferPool(view)==-1){
+		free(view);
+		printf("Not enough memory for the file system\n");
+		return NULL;
+	}
+	view->superBlock=fs->superBlock;
+	memcpy(view->inodes, fs->snapshots[s].inodes, sizeof(view->inodes));
+	memcpy(view->disk_inodes, view->inodes, sizeof(view->inodes));
+	indexInodes(view);
+	view->snapshot_view=s;
+	view->parent=fs;
+	fs->snapshot_views[s]++;
+	return view;
+}
+
+/*
+ * @brief	Starts a listing of the entries of a directory.
+ * @return	The iterator descriptor if possible, -1 if the directory does not exist, -2 in case of error.
+ */
+static int doOpenDirIter(fs_t *fs, char *path)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -2;
+	}
+	int i=lookupPath(fs, path);
+	if(i==-1 || fs->inodes[i].type!='D'){
+		printf("The directory does not exist\n");
+		return -1;
+	}
+	for(int d=0;d<MAX_DIR_ITERS;d++){//and we take the first free iterator
+		if(!fs->dir_iters[d].used){
+			fs->dir_iters[d].used=1;
+			fs->dir_iters[d].dir=i;
+			fs->dir_iters[d].pos=0;
+			return d;
+		}
+	}
+	printf("There are too many directory listings opened\n");
+	return -2;
+}
+
+/*
+ * @brief	Copies up to maxEntries of the next entries of the directory, with their inode, type and size.
+ * @return	Number of entries copied (0 at the end of the directory), -1 in case of error.
+ */
+static int doReadDirIter(fs_t *fs, int iter, fsDirEntry *entries, int maxEntries)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -1;
+	}
+	if(iter<0 || iter>=MAX_DIR_ITERS || !fs->dir_iters[iter].used){
+		printf("The iterator descriptor does not correspond to any opened listing\n");
+		return -1;
+	}
+	struct dirIter *it=&fs->dir_iters[iter];
+	struct inode *dir=&fs->inodes[it->dir];
+	int n=0;
+	for(;it->pos<10 && n<maxEntries;it->pos++){
+		if(!dir->contents[it->pos]) continue;
+
+		struct inode *item=&fs->inodes[dir->contents[it->pos]];
+		entries[n].inode=item->id;
+		entries[n].type=item->type;
+		entries[n].size=item->type=='F' ? item->size : 0;
+		strcpy(entries[n].name, item->name);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * @brief	Finishes a directory listing.
+ * @return	0 if success, -1 otherwise.
+ */
+static int doCloseDirIter(fs_t *fs, int iter)
+{
+	if(!fs->superBlock.mounted){//We check if the disk is mounted
+		printf("disk not mounted yet\n");
+		return -1;
+	}
+	if(iter<0 || iter>=MAX_DIR_ITERS || !fs->dir_iters[iter].used){
+		printf("The iterator descriptor does not correspond to any opened listing\n");
+		return -1;
+	}
+	fs->dir_iters[iter].used=0;
+	return 0;
+}
+
+/*
+ * @brief	Creates a handle for the file system stored in a device image.
+ * @return	The handle if success, NULL otherwise.
+ */
+fs_t *fsOpen(const char *image)
+{
+	if(strlen(image)>=sizeof(default_fs.image)){
+		printf("Name of the device image too long\n");
+		return NULL;
+	}
+	fs_t *fs=calloc(1, sizeof(struct fs));
+	if(!fs){
+		printf("Not enough memory for the file system\n");
+		return NULL;
+	}
+	strcpy(fs->image, image);
+	fs->trace_id=__atomic_add_fetch(&trace_ids, 1, __ATOMIC_RELAXED);//The calls without a handle keep 0
+	pthread_mutex_init(&fs->append_lock, NULL);
+	fs->snapshot_view=-1;
+	fs->queue.window=QUEUE_DEPTH;
+	return fs;
+}
+
+/*
+ * @brief	Unmounts the file system of a handle if needed and releases the handle. If it cannot be unmounted, as while a snapshot of it is opened, the handle is kept.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsClose(fs_t *fs)
+{
+	if(fs==&default_fs){
+		printf("The default file system cannot be closed\n");
+		return -1;
+	}
+	if(fs->snapshot_view!=-1) fs->parent->snapshot_views[fs->snapshot_view]--;//A snapshot only reads, there is nothing to write back
+	else if(fs->superBlock.mounted && fsUnmountFS(fs)!=0) return -1;//Nothing is freed, the data and the snapshots opened still need it
+	freeBufferPool(fs);
+	pthread_mutex_destroy(&fs->append_lock);
+	free(fs);
+	return 0;
+}
+
+/*
+ * Calls of the interface: every call is recorded in the trace log and in the
+ * statistics before being performed.
+ */
+
+/*
+ * @brief	Finds the seek pointer of an opened file, recorded with its reads and writes. Appenders move it with the append lock held.
+ * @return	The position in the file, -1 if the descriptor does not correspond to any file or the calls are not being traced.
+ */
+static long filePosition(fs_t *fs, int fileDescriptor)
+{
+	if(!traceEnabled()) return -1;
+	long position=-1;
+	pthread_mutex_lock(&fs->append_lock);
+	for(int i=0;i<40 && position==-1;i++){
+		if(fs->inodes[i].type=='F' && fs->inodes[i].id==fileDescriptor) position=fs->inodes[i].seek_ptr;
+	}
+	pthread_mutex_unlock(&fs->append_lock);
+	return position;
+}
+
+int fsMkFS(fs_t *fs, long deviceSize)
+{
+	return fsMkFSBlockSize(fs, deviceSize, BLOCK_SIZE);
+}
+
+int fsMkFSBlockSize(fs_t *fs, long deviceSize, int blockSize)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_MKFS, fs->image, -1, blockSize, deviceSize);
+	EVENT_BEGIN(FS_OP_MKFS, 0);
+	int ret=doMkFS(fs, deviceSize, blockSize);
+	EVENT_END(FS_OP_MKFS, ret);
+	statsEnd(FS_OP_MKFS, start);
+	return ret;
+}
+
+int fsMountFS(fs_t *fs)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_MOUNT, fs->image, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_MOUNT, 0);
+	int ret=doMountFS(fs);
+	EVENT_END(FS_OP_MOUNT, ret);
+	statsEnd(FS_OP_MOUNT, start);
+	return ret;
+}
+
+int fsUnmountFS(fs_t *fs)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_UNMOUNT, NULL, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_UNMOUNT, 0);
+	int ret=doUnmountFS(fs);
+	EVENT_END(FS_OP_UNMOUNT, ret);
+	statsEnd(FS_OP_UNMOUNT, start);
+	return ret;
+}
+
+int fsCreateFile(fs_t *fs, char *path)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_CREATE, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_CREATE, 0);
+	int ret=doCreateFile(fs, path);
+	EVENT_END(FS_OP_CREATE, ret);
+	statsEnd(FS_OP_CREATE, start);
+	return ret;
+}
+
+int fsRemoveFile(fs_t *fs, char *path)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_REMOVE, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_REMOVE, 0);
+	int ret=doRemoveFile(fs, path);
+	EVENT_END(FS_OP_REMOVE, ret);
+	statsEnd(FS_OP_REMOVE, start);
+	return ret;
+}
+
+int fsOpenFile(fs_t *fs, char *path)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_OPEN, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_OPEN, 0);
+	int ret=doOpenFile(fs, path);
+	EVENT_END(FS_OP_OPEN, ret);
+	statsEnd(FS_OP_OPEN, start);
+	return ret;
+}
+
+int fsOpenFileAppend(fs_t *fs, char *path)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_OPEN, path, -1, 1, 0);//The size marks the append mode
+	EVENT_BEGIN(FS_OP_OPEN, 1);
+	int ret=doOpenFileAppend(fs, path);
+	EVENT_END(FS_OP_OPEN, ret);
+	statsEnd(FS_OP_OPEN, start);
+	return ret;
+}
+
+int fsCloseFile(fs_t *fs, int fileDescriptor)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_CLOSE, NULL, fileDescriptor, 0, 0);
+	EVENT_BEGIN(FS_OP_CLOSE, 0);
+	int ret=doCloseFile(fs, fileDescriptor);
+	EVENT_END(FS_OP_CLOSE, ret);
+	statsEnd(FS_OP_CLOSE, start);
+	return ret;
+}
+
+int fsFsyncFile(fs_t *fs, int fileDescriptor)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_FSYNC, NULL, fileDescriptor, 0, 0);
+	EVENT_BEGIN(FS_OP_FSYNC, 0);
+	int ret=doFsyncFile(fs, fileDescriptor);
+	EVENT_END(FS_OP_FSYNC, ret);
+	statsEnd(FS_OP_FSYNC, start);
+	return ret;
+}
+
+int fsStatFile(fs_t *fs, char *path, fsFileStat *stat)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_STAT, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_STAT, 0);
+	int ret=doStatFile(fs, path, stat);
+	EVENT_END(FS_OP_STAT, ret);
+	statsEnd(FS_OP_STAT, start);
+	return ret;
+}
+
+int fsOpenDirIter(fs_t *fs, char *path)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_OPENDIR, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_OPENDIR, 0);
+	int ret=doOpenDirIter(fs, path);
+	EVENT_END(FS_OP_OPENDIR, ret);
+	statsEnd(FS_OP_OPENDIR, start);
+	return ret;
+}
+
+int fsReadDirIter(fs_t *fs, int iter, fsDirEntry *entries, int maxEntries)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_READDIR, NULL, iter, maxEntries, 0);
+	EVENT_BEGIN(FS_OP_READDIR, iter);
+	int ret=doReadDirIter(fs, iter, entries, maxEntries);
+	EVENT_END(FS_OP_READDIR, ret);
+	statsEnd(FS_OP_READDIR, start);
+	return ret;
+}
+
+int fsCloseDirIter(fs_t *fs, int iter)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_CLOSEDIR, NULL, iter, 0, 0);
+	EVENT_BEGIN(FS_OP_CLOSEDIR, iter);
+	int ret=doCloseDirIter(fs, iter);
+	EVENT_END(FS_OP_CLOSEDIR, ret);
+	statsEnd(FS_OP_CLOSEDIR, start);
+	return ret;
+}
+
+int fsReadFile(fs_t *fs, int fileDescriptor, void *buffer, int numBytes)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_READ, NULL, fileDescriptor, numBytes, filePosition(fs, fileDescriptor));
+	EVENT_BEGIN(FS_OP_READ, 0);
+	int ret=doReadFile(fs, fileDescriptor, buffer, numBytes);
+	EVENT_END(FS_OP_READ, ret);
+	statsEnd(FS_OP_READ, start);
+	return ret;
+}
+
+int fsWriteFile(fs_t *fs, int fileDescriptor, void *buffer, int numBytes)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_WRITE, NULL, fileDescriptor, numBytes, filePosition(fs, fileDescriptor));
+	EVENT_BEGIN(FS_OP_WRITE, 0);
+	int ret=doWriteFile(fs, fileDescriptor, buffer, numBytes);
+	EVENT_END(FS_OP_WRITE, ret);
+	statsEnd(FS_OP_WRITE, start);
+	return ret;
+}
+
+int fsLseekFile(fs_t *fs, int fileDescriptor, long offset, int whence)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_LSEEK, NULL, fileDescriptor, whence, offset);
+	EVENT_BEGIN(FS_OP_LSEEK, 0);
+	int ret=doLseekFile(fs, fileDescriptor, offset, whence);
+	EVENT_END(FS_OP_LSEEK, ret);
+	statsEnd(FS_OP_LSEEK, start);
+	return ret;
+}
+
+int fsMkDir(fs_t *fs, char *path)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_MKDIR, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_MKDIR, 0);
+	int ret=doMkDir(fs, path);
+	EVENT_END(FS_OP_MKDIR, ret);
+	statsEnd(FS_OP_MKDIR, start);
+	return ret;
+}
+
+int fsRmDir(fs_t *fs, char *path)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_RMDIR, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_RMDIR, 0);
+	int ret=doRmDir(fs, path);
+	EVENT_END(FS_OP_RMDIR, ret);
+	statsEnd(FS_OP_RMDIR, start);
+	return ret;
+}
+
+int fsRenamePath(fs_t *fs, char *oldPath, char *newPath)
+{
+	long start=statsStart();
+	char paths[strlen(oldPath)+strlen(newPath)+1];//Both paths are recorded one after the other
+	strcpy(paths, oldPath);
+	strcat(paths, newPath);
+	traceCall(fs->trace_id, FS_OP_RENAME, paths, -1, strlen(oldPath), 0);
+	EVENT_BEGIN(FS_OP_RENAME, 0);
+	int ret=doRenamePath(fs, oldPath, newPath);
+	EVENT_END(FS_OP_RENAME, ret);
+	statsEnd(FS_OP_RENAME, start);
+	return ret;
+}
+
+int fsRmTree(fs_t *fs, char *path)
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_RMTREE, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_RMTREE, 0);
+	int ret=doRmTree(fs, path);
+	EVENT_END(FS_OP_RMTREE, ret);
+	statsEnd(FS_OP_RMTREE, start);
+	return ret;
+}
+
+int fsCopyTree(fs_t *fs, char *srcPath, char *dstPath)
+{
+	long start=statsStart();
+	char paths[strlen(srcPath)+strlen(dstPath)+1];//Both paths are recorded one after the other
+	strcpy(paths, srcPath);
+	strcat(paths, dstPath);
+	traceCall(fs->trace_id, FS_OP_COPYTREE, paths, -1, strlen(srcPath), 0);
+	EVENT_BEGIN(FS_OP_COPYTREE, 0);
+	int ret=doCopyTree(fs, srcPath, dstPath);
+	EVENT_END(FS_OP_COPYTREE, ret);
+	statsEnd(FS_OP_COPYTREE, start);
+	return ret;
+}
+
+int fsLsDir(fs_t *fs, char *path, int inodesDir[10], char namesDir[10][33])
+{
+	long start=statsStart();
+	traceCall(fs->trace_id, FS_OP_LSDIR, path, -1, 0, 0);
+	EVENT_BEGIN(FS_OP_LSDIR, 0);
+	int ret=doLsDir(fs, path, inodesDir, namesDir);
+	EVENT_END(FS_OP_LSDIR, ret);
+	statsEnd(FS_OP_LSDIR, start);
+	return ret;
+}
+
+/*
+ * Calls without a handle, performed on the file system of DEVICE_IMAGE.
+ */
+
+int mkFS(long deviceSize)
+{
+	return fsMkFS(&default_fs, deviceSize);
+}
+
+int mkFSBlockSize(long deviceSize, int blockSize)
+{
+	return fsMkFSBlockSize(&default_fs, deviceSize, blockSize);
+}
+
+int mountFS(void)
+{
+	return fsMountFS(&default_fs);
+}
+
+int unmountFS(void)
+{
+	return fsUnmountFS(&default_fs);
+}
+
+int createFile(char *path)
+{
+	return fsCreateFile(&default_fs, path);
+}
+
+int removeFile(char *path)
+{
+	return fsRemoveFile(&default_fs, path);
+}
+
+int openFile(char *path)
+{
+	return fsOpenFile(&default_fs, path);
+}
+
+int openFileAppend(char *path)
+{
+	return fsOpenFileAppend(&default_fs, path);
+}
+
+int closeFile(int fileDescriptor)
+{
+	return fsCloseFile(&default_fs, fileDescriptor);
+}
+
+int fsyncFile(int fileDescriptor)
+{
+	return fsFsyncFile(&default_fs, fileDescriptor);
+}
+
+int statFile(char *path, fsFileStat *stat)
+{
+	return fsStatFile(&default_fs, path, stat);
+}
+
+int readFile(int fileDescriptor, void *buffer, int numBytes)
+{
+	return fsReadFile(&default_fs, fileDescriptor, buffer, numBytes);
+}
+
+int writeFile(int fileDescriptor, void *buffer, int numBytes)
+{
+	return fsWriteFile(&default_fs, fileDescriptor, buffer, numBytes);
+}
+
+int lseekFile(int fileDescriptor, long offset, int whence)
+{
+	return fsLseekFile(&default_fs, fileDescriptor, offset, whence);
+}
+
+int mkDir(char *path)
+{
+	return fsMkDir(&default_fs, path);
+}
+
+int rmDir(char *path)
+{
+	return fsRmDir(&default_fs, path);
+}
+
+int lsDir(char *path, int inodesDir[10], char namesDir[10][33])
+{
+	return fsLsDir(&default_fs, path, inodesDir, namesDir);
+}
+
+int renamePath(char *oldPath, char *newPath)
+{
+	return fsRenamePath(&default_fs, oldPath, newPath);
+}
+
+int rmTree(char *path)
+{
+	return fsRmTree(&default_fs, path);
+}
+
+int copyTree(char *srcPath, char *dstPath)
+{
+	return fsCopyTree(&default_fs, srcPath, dstPath);
+}
+
+int setDedupMode(int enabled)
+{
+	return fsSetDedupMode(&default_fs, enabled);
+}
+
+int setSecureErase(int enabled)
+{
+	return fsSetSecureErase(&default_fs, enabled);
+}
+
+int setDirectIO(int enabled)
+{
+	return fsSetDirectIO(&default_fs, enabled);
+}
+
+int setWriteBehind(int enabled, int maxAgeMs)
+{
+	return fsSetWriteBehind(&default_fs, enabled, maxAgeMs);
+}
+
+int setIoWindow(int requests)
+{
+	return fsSetIoWindow(&default_fs, requests);
+}
+
+int discard(void)
+{
+	return fsDiscard(&default_fs);
+}
+
+int createSnapshot(char *name)
+{
+	return fsCreateSnapshot(&default_fs, name);
+}
+
+int deleteSnapshot(char *name)
+{
+	return fsDeleteSnapshot(&default_fs, name);
+}
+
+fs_t *openSnapshot(char *name)
+{
+	return fsOpenSnapshot(&default_fs, name);
+}
+
+int openDirIter(char *path)
+{
+	return fsOpenDirIter(&default_fs, path);
+}
+
+int readDirIter(int iter, fsDirEntry *entries, int maxEntries)
+{
+	return fsReadDirIter(&default_fs, iter, entries, maxEntries);
+}
+
+int closeDirIter(int iter)
+{
+	return fsCloseDirIter(&default_fs, iter);
 }
@@ -0,0 +1,401 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	fsck.c
+ * @brief 	Checks, and optionally repairs, the metadata of a device image.
+ * @date	01/03/2017
+ *
+ * Usage: ./fsck [-r] [image]
+ *
+ * The superblock and all the inode blocks are read sequentially, and then the
+ * data block allocation, the links between directories and their contents and
+ * the inodes themselves are checked by one thread each. With -r the problems
+ * are repaired once the checks finish and the metadata is written back.
+ *
+ * Exits with 0 if the image is consistent, 1 if the problems were repaired and
+ * 4 if problems were left in the image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "include/filesystem.h"
+#include "include/metadata.h"
+
+#define NUM_INODES 40
+#define MAX_REPORT 4096
+
+typedef struct check {
+	void *(*run)(void *);
+	char report[MAX_REPORT]; // Problems found, one per line
+	int used;
+	int problems;
+} check;
+
+static struct sBlock sb;
+static struct inode inodes[NUM_INODES];
+static struct snapshot snapshots[MAX_SNAPSHOTS]; // Read from their records, unused if the record is broken
+static const struct blockDevice *dev;
+
+static void problem(check *c, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	if (c->used < MAX_REPORT)
+		c->used += vsnprintf(c->report + c->used, MAX_REPORT - c->used, format, args);
+	va_end(args);
+	c->problems++;
+}
+
+static int in_use(int n)
+{
+	return n >= 0 && n < NUM_INODES && (inodes[n].type == 'D' || inodes[n].type == 'F');
+}
+
+static int valid_block(int block)
+{
+	return block >= sb.first_data_block && block < sb.first_data_block + NUM_INODES && block < sb.partitionBlocks;
+}
+
+/*
+ * Counts the references the snapshots hold: one for each block of their
+ * records and one for each block in their bitmaps.
+ */
+static void snapshot_refs(int refs[NUM_INODES])
+{
+	int record_blocks = (sizeof(struct snapshot) + dev->size - 1) / dev->size;
+	for (int s = 0; s < MAX_SNAPSHOTS; s++) {
+		if (!snapshots[s].used)
+			continue;
+		for (int k = 0; k < record_blocks; k++)
+			refs[sb.snapshot_blocks[s][k] - sb.first_data_block]++;
+		for (int n = 0; n < NUM_INODES; n++)
+			refs[n] += !!bitmap_getbit(snapshots[s].bitmap, n);
+	}
+}
+
+/*
+ * The bitmap and the reference counts must match the data blocks of the files
+ * and of the snapshots.
+ */
+static void *check_blocks(void *arg)
+{
+	check *c = arg;
+	int refs[NUM_INODES] = {0};
+
+	snapshot_refs(refs);
+	for (int s = 0; s < MAX_SNAPSHOTS; s++) {
+		if (sb.snapshot_blocks[s][0] && !snapshots[s].used)
+			problem(c, "snapshot %d: its record is broken\n", s);
+	}
+
+	for (int i = 0; i < NUM_INODES; i++) {
+		for (int k = 0; inodes[i].type == 'F' && k < FILE_BLOCKS; k++) {
+			int block = inodes[i].blocks[k];
+			if (!block) // Holes and files never written have no block
+				continue;
+			if (!valid_block(block))
+				problem(c, "inode %d: data block %d is outside the data area\n", i, block);
+			else
+				refs[block - sb.first_data_block]++;
+		}
+	}
+	for (int n = 0; n < NUM_INODES; n++) {
+		if (!!bitmap_getbit(sb.bitmap, n) != (refs[n] > 0))
+			problem(c, "block %d: bitmap says %s but %d files or snapshots use it\n", n,
+					bitmap_getbit(sb.bitmap, n) ? "used" : "free", refs[n]);
+		else if (refs[n] && sb.block_refs[n] != refs[n])
+			problem(c, "block %d: reference count %d but %d files or snapshots use it\n", n, sb.block_refs[n], refs[n]);
+	}
+	return NULL;
+}
+
+/*
+ * Every entry of a directory must point back to it with its parent, once, and
+ * every inode must be an entry of its parent.
+ */
+static void *check_links(void *arg)
+{
+	check *c = arg;
+
+	if (inodes[0].type != 'D')
+		problem(c, "inode 0: the root is not a directory\n");
+	for (int i = 0; i < NUM_INODES; i++) {
+		if (inodes[i].type != 'D')
+			continue;
+		for (int k = 0; k < 10; k++) {
+			int n = inodes[i].contents[k];
+			if (!n)
+				continue;
+			if (!in_use(n) || inodes[n].parent != i) {
+				problem(c, "inode %d: entry %d points to inode %d, which is not inside it\n", i, k, n);
+				continue;
+			}
+			for (int j = 0; j < k; j++) {
+				if (inodes[i].contents[j] == n)
+					problem(c, "inode %d: inode %d is listed twice\n", i, n);
+				else if (in_use(inodes[i].contents[j]) && !strcmp(inodes[inodes[i].contents[j]].name, inodes[n].name))
+					problem(c, "inode %d: two entries are named \"%s\"\n", i, inodes[n].name);
+			}
+		}
+	}
+	for (int i = 1; i < NUM_INODES; i++) {
+		if (!in_use(i))
+			continue;
+		int p = inodes[i].parent, listed = 0;
+		for (int k = 0; p >= 0 && p < NUM_INODES && inodes[p].type == 'D' && k < 10; k++)
+			listed |= inodes[p].contents[k] == i;
+		if (!listed)
+			problem(c, "inode %d: \"%s\" is not an entry of its parent %d\n", i, inodes[i].name, p);
+	}
+	return NULL;
+}
+
+/*
+ * The inodes must be well formed and the superblock must count them.
+ */
+static void *check_inodes(void *arg)
+{
+	check *c = arg;
+	int items = 0;
+
+	for (int i = 0; i < NUM_INODES; i++) {
+		if (!in_use(i)) {
+			if (inodes[i].type)
+				problem(c, "inode %d: unknown type %d\n", i, inodes[i].type);
+			continue;
+		}
+		items++;
+		if (inodes[i].id != i)
+			problem(c, "inode %d: it says to be inode %d\n", i, inodes[i].id);
+		if (i && (!inodes[i].name[0] || memchr(inodes[i].name, '/', sizeof(inodes[i].name))))
+			problem(c, "inode %d: invalid name\n", i);
+		if (inodes[i].type == 'F' && (inodes[i].size < 0 || inodes[i].size > FILE_BLOCKS * sb.block_size))
+			problem(c, "inode %d: length %d is outside the file\n", i, inodes[i].size);
+	}
+	if (sb.num_items != items)
+		problem(c, "superblock: %d items counted but %d inodes are used\n", sb.num_items, items);
+	if (sb.mounted)
+		problem(c, "superblock: the image was not unmounted\n");
+	return NULL;
+}
+
+/*
+ * Removes an inode, and everything below it if it is a directory.
+ */
+static void free_inode(int n)
+{
+	if (inodes[n].type == 'D') {
+		for (int k = 0; k < 10; k++) {
+			int child = inodes[n].contents[k];
+			if (in_use(child) && child && inodes[child].parent == n)
+				free_inode(child);
+		}
+	}
+	memset(&inodes[n], 0, sizeof(struct inode));
+}
+
+/*
+ * Rebuilds the metadata from the inodes: broken links are dropped, lost
+ * inodes are put back in their parent when possible and deleted otherwise,
+ * and the bitmap and the counters are computed again.
+ */
+static void repair(void)
+{
+	inodes[0].type = 'D';
+	inodes[0].parent = 0;
+	inodes[0].name[0] = '\0';
+	for (int i = 0; i < NUM_INODES; i++) {
+		if (!in_use(i) || (i && (!inodes[i].name[0] || memchr(inodes[i].name, '/', sizeof(inodes[i].name)))))
+			memset(&inodes[i], 0, sizeof(struct inode));
+		else
+			inodes[i].id = i;
+		for (int k = 0; inodes[i].type == 'F' && k < FILE_BLOCKS; k++) {
+			if (inodes[i].blocks[k] && !valid_block(inodes[i].blocks[k]))
+				inodes[i].blocks[k] = 0; // The bad block becomes a hole
+		}
+		if (inodes[i].type == 'F' && (inodes[i].size < 0 || inodes[i].size > FILE_BLOCKS * sb.block_size))
+			inodes[i].size = inodes[i].size < 0 ? 0 : FILE_BLOCKS * sb.block_size;
+	}
+	inodes[0].type = 'D';
+
+	for (int changed = 1; changed;) {
+		changed = 0;
+		for (int i = 0; i < NUM_INODES; i++) {
+			for (int k = 0; inodes[i].type == 'D' && k < 10; k++) {
+				int n = inodes[i].contents[k], keep = n && in_use(n) && inodes[n].parent == i;
+				for (int j = 0; keep && j < k; j++)
+					keep = inodes[i].contents[j] != n && strcmp(inodes[inodes[i].contents[j]].name, inodes[n].name);
+				if (n && !keep) {
+					inodes[i].contents[k] = 0;
+					changed = 1;
+				}
+			}
+		}
+		for (int i = 1; i < NUM_INODES; i++) {
+			if (!in_use(i))
+				continue;
+			int p = inodes[i].parent, listed = 0, slot = -1, taken = 0;
+			if (p < 0 || p >= NUM_INODES || inodes[p].type != 'D') {
+				free_inode(i);
+				changed = 1;
+				continue;
+			}
+			for (int k = 9; k >= 0; k--) {
+				listed |= inodes[p].contents[k] == i;
+				if (!inodes[p].contents[k])
+					slot = k;
+				else if (inodes[p].contents[k] != i && !strcmp(inodes[inodes[p].contents[k]].name, inodes[i].name))
+					taken = 1; // Another entry already has the name
+			}
+			if (listed)
+				continue;
+			if (slot >= 0 && !taken)
+				inodes[p].contents[slot] = i;
+			else
+				free_inode(i);
+			changed = 1;
+		}
+	}
+
+	int items = 0;
+	bzero(sb.bitmap, sizeof(sb.bitmap));
+	bzero(sb.block_refs, sizeof(sb.block_refs));
+	for (int s = 0; s < MAX_SNAPSHOTS; s++) {
+		if (!snapshots[s].used) // The broken snapshots are dropped
+			bzero(sb.snapshot_blocks[s], sizeof(sb.snapshot_blocks[s]));
+	}
+	int refs[NUM_INODES] = {0};
+	snapshot_refs(refs);
+	for (int n = 0; n < NUM_INODES; n++) {
+		sb.block_refs[n] = refs[n];
+		bitmap_setbit(sb.bitmap, n, refs[n] > 0);
+	}
+	for (int i = 0; i < NUM_INODES; i++) {
+		if (!in_use(i))
+			continue;
+		items++;
+		for (int k = 0; inodes[i].type == 'F' && k < FILE_BLOCKS; k++) {
+			if (!inodes[i].blocks[k])
+				continue;
+			int n = inodes[i].blocks[k] - sb.first_data_block;
+			sb.block_refs[n]++;
+			bitmap_setbit(sb.bitmap, n, 1);
+		}
+	}
+	for (int n = 0; n < NUM_INODES; n++) {
+		if (!sb.block_refs[n])
+			sb.block_hash[n] = 0;
+	}
+	sb.num_items = items;
+	sb.mounted = 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int fix = argc > 1 && !strcmp(argv[1], "-r");
+	if (argc > 2 + fix) {
+		fprintf(stderr, "Syntax: ./fsck [-r] [image]\n");
+		return -1;
+	}
+	char *image = argc > 1 + fix ? argv[1 + fix] : DEVICE_IMAGE;
+
+	// The superblock is read with the smallest block size, as the block size is stored in it
+	char supblock[MIN_BLOCK_SIZE];
+	if (blockDeviceFor(MIN_BLOCK_SIZE)->bread(image, 0, supblock) == -1) {
+		fprintf(stderr, "ERROR: UNABLE TO READ DISK FILE %s\n", image);
+		return -1;
+	}
+	memcpy(&sb, supblock, sizeof(sb));
+	int inodes_per_block = sb.block_size ? sb.block_size / (int)sizeof(struct inode) : 0;
+	if (sb.magic != FS_MAGIC || !(dev = blockDeviceFor(sb.block_size)) ||
+		sb.first_data_block != 1 + (NUM_INODES + inodes_per_block - 1) / inodes_per_block ||
+		sb.partitionBlocks <= sb.first_data_block) {
+		fprintf(stderr, "ERROR: THERE IS NO FILE SYSTEM IN %s\n", image);
+		return 4;
+	}
+
+	// All the inode blocks are read with one sequential request
+	int nblocks = sb.first_data_block - 1, blocks[nblocks];
+	char *inode_blocks = malloc((size_t)nblocks * dev->size);
+	for (int x = 0; x < nblocks; x++)
+		blocks[x] = x + 1;
+	if (!inode_blocks || dev->breadv(image, blocks, nblocks, inode_blocks) == -1) {
+		fprintf(stderr, "ERROR: UNABLE TO READ THE INODES OF %s\n", image);
+		free(inode_blocks);
+		return -1;
+	}
+	for (int x = 0; x < nblocks; x++) {
+		int first = x * inodes_per_block;
+		int count = NUM_INODES - first < inodes_per_block ? NUM_INODES - first : inodes_per_block;
+		if (sb.initialized_inode_blocks & (1u << x)) // The rest are read as empty
+			memcpy(&inodes[first], inode_blocks + (size_t)x * dev->size, count * sizeof(struct inode));
+	}
+	if (!(sb.initialized_inode_blocks & 1u))
+		inodes[0].type = 'D';
+
+	// The records of the snapshots listed in the superblock, each one with a request
+	int record_blocks = (sizeof(struct snapshot) + dev->size - 1) / dev->size;
+	char *record = malloc((size_t)record_blocks * dev->size);
+	for (int s = 0; record && s < MAX_SNAPSHOTS; s++) {
+		int valid = sb.snapshot_blocks[s][0] != 0;
+		for (int k = 0; valid && k < record_blocks; k++)
+			valid = valid_block(sb.snapshot_blocks[s][k]);
+		if (valid && dev->breadv(image, sb.snapshot_blocks[s], record_blocks, record) != -1)
+			memcpy(&snapshots[s], record, sizeof(struct snapshot));
+	}
+	free(record);
+
+	static check checks[] = {{check_blocks}, {check_links}, {check_inodes}};
+	int nchecks = sizeof(checks) / sizeof(checks[0]), problems = 0;
+	pthread_t threads[nchecks];
+	int started[nchecks];
+	for (int k = 0; k < nchecks; k++) {
+		// The checks only read the metadata, so they run at the same time
+		started[k] = pthread_create(&threads[k], NULL, checks[k].run, &checks[k]) == 0;
+		if (!started[k])
+			checks[k].run(&checks[k]);
+	}
+	for (int k = 0; k < nchecks; k++) {
+		if (started[k])
+			pthread_join(threads[k], NULL);
+		fputs(checks[k].report, stdout);
+		problems += checks[k].problems;
+	}
+	if (!problems) {
+		int used = 0;
+		for (int n = 0; n < NUM_INODES; n++)
+			used += !!bitmap_getbit(sb.bitmap, n);
+		printf("%s: clean, %d items, %d of %d data blocks used\n", image, sb.num_items, used, NUM_INODES);
+		free(inode_blocks);
+		return 0;
+	}
+	if (!fix) {
+		printf("%s: %d problems found, run with -r to repair them\n", image, problems);
+		free(inode_blocks);
+		return 4;
+	}
+
+	// The repaired inodes and superblock are written back, every inode block included
+	repair();
+	for (int x = 0; x < nblocks; x++) {
+		int first = x * inodes_per_block;
+		int count = NUM_INODES - first < inodes_per_block ? NUM_INODES - first : inodes_per_block;
+		memset(inode_blocks + (size_t)x * dev->size, 0, dev->size);
+		memcpy(inode_blocks + (size_t)x * dev->size, &inodes[first], count * sizeof(struct inode));
+	}
+	sb.initialized_inode_blocks = (1u << nblocks) - 1;
+	char block[dev->size];
+	memset(block, 0, sizeof(block));
+	memcpy(block, &sb, sizeof(sb));
+	if (dev->bwritev(image, blocks, nblocks, inode_blocks) == -1 || dev->bwrite(image, 0, block) == -1) {
+		fprintf(stderr, "ERROR: UNABLE TO WRITE DISK FILE %s\n", image);
+		free(inode_blocks);
+		return 4;
+	}
+	printf("%s: %d problems repaired, %d items left\n", image, problems, sb.num_items);
+	free(inode_blocks);
+	return 1;
+}
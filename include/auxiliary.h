@@ -5,3 +5,249 @@
  * @brief 	Headers for the auxiliary functions required by filesystem.c.
  * @date	01/03/2017
  */
+
+#ifndef _AUXILIARY_H_
+#define _AUXILIARY_H_
+
+#include "filesystem.h"
+
+/*
+ * @brief	Computes the hash of the content of a data block.
+ * @return	The 32 bit FNV-1a hash of the block.
+ */
+unsigned int blockHash(char *block, int size);
+
+/*
+ * @brief	Looks for a data block with the same content in the deduplication index.
+ * @return	The index of the data block if found, -1 otherwise.
+ */
+int dedupLookup(fs_t *fs, unsigned int hash, char *block);
+
+/*
+ * @brief	Reserves the first free data block of the bitmap starting from goal, going back to the first one if needed.
+ * @return	The index of the data block if success, -1 otherwise.
+ */
+int allocDataBlock(fs_t *fs, int goal);
+
+/*
+ * @brief	Chooses where block k of a file should go: after the previous block of the file or, for the first one, after the last block of the files of its directory, inside the block group of the file.
+ * @return	The index of the data block to start looking from.
+ */
+int allocGoal(fs_t *fs, int inode, int k);
+
+/*
+ * @brief	Chooses a free inode for a new file or directory. A file goes in the block group of its directory, a directory in the group with the most free inodes.
+ * @return	The index of the free inode, -1 if there is none.
+ */
+int allocInode(fs_t *fs, int parent, char type);
+
+/*
+ * @brief	Computes the first data block of a block group, the data blocks of the partition are split evenly between the groups.
+ * @return	The index of the first data block of the group.
+ */
+int groupFirstBlock(fs_t *fs, int group);
+
+/*
+ * @brief	Lists the data blocks of a file, without its holes.
+ * @return	The number of data block indexes copied into n.
+ */
+int fileBlocks(fs_t *fs, int inode, int *n);
+
+/*
+ * @brief	Drops a reference to a data block, freeing it when no file uses it anymore.
+ * @return	0 if success, -1 otherwise.
+ */
+int releaseDataBlock(fs_t *fs, int n);
+
+/*
+ * @brief	Drops a reference to each of count data blocks. The ones no file uses anymore are queued to be discarded, or zeroed at once with secure erase.
+ * @return	0 if success, -1 otherwise.
+ */
+int releaseDataBlocks(fs_t *fs, int *n, int count);
+
+/*
+ * @brief	Punches holes in the image for the freed data blocks that are waiting to be discarded.
+ * @return	0 if success, -1 otherwise.
+ */
+int discardBlocks(fs_t *fs);
+
+/*
+ * @brief	Writes block k of a file, sharing or copying its data block if deduplication is on. Blocks of zeros stay as holes.
+ * @return	1 if the metadata changed and has to be written, 0 if it did not, -1 in case of error.
+ */
+int dedupWrite(fs_t *fs, int inode, int k, char *block);
+
+/*
+ * @brief	Chooses the block functions for a block size, with O_DIRECT if the handle asks for it.
+ * @return	The block functions, NULL if the block size is not supported.
+ */
+const struct blockDevice *deviceFor(fs_t *fs, int blockSize);
+
+/*
+ * @brief	Allocates the aligned buffer pool for the block size of the file system, keeping it if it already fits.
+ * @return	0 if success, -1 otherwise.
+ */
+int initBufferPool(fs_t *fs);
+
+/*
+ * @brief	Releases the buffer pool, and the tail blocks taken from it.
+ */
+void freeBufferPool(fs_t *fs);
+
+/*
+ * @brief	Takes count consecutive block buffers from the pool.
+ * @return	The first buffer if success, NULL otherwise.
+ */
+char *getBuffers(fs_t *fs, int count);
+
+/*
+ * @brief	Gives back count block buffers taken with getBuffers.
+ */
+void putBuffers(fs_t *fs, char *buffers, int count);
+
+/*
+ * @brief	Looks for the write buffer of a file.
+ * @return	The index of the buffer, -1 if the file has none.
+ */
+int findWriteBuffer(fs_t *fs, int inode);
+
+/*
+ * @brief	Writes the blocks held by a write buffer, with the metadata once at the end, and empties it.
+ * @return	0 if success, -1 otherwise.
+ */
+int flushWriteBuffer(fs_t *fs, int w);
+
+/*
+ * @brief	Flushes the write buffers of a file, or of all of them if inode is -1, whose oldest write is at least age nanoseconds old.
+ * @return	0 if success, -1 otherwise.
+ */
+int flushWriteBuffers(fs_t *fs, int inode, long age);
+
+/*
+ * @brief	Releases the write buffers without writing them, or only the one of a file if inode is not -1.
+ */
+void releaseWriteBuffers(fs_t *fs, int inode);
+
+/*
+ * @brief	Copies bytes into the write buffer of a file at its seek pointer, reading first the blocks that are partially written.
+ * @return	Number of bytes buffered, -2 in case of error.
+ */
+int bufferedWrite(fs_t *fs, int i, char *buffer, int numBytes);
+
+/*
+ * @brief	Looks for the append slot of a file.
+ * @return	The index of the slot, -1 if the file is not opened in append mode.
+ */
+int findTail(fs_t *fs, int inode);
+
+/*
+ * @brief	Loads the block that holds the tail of an append slot, with the bytes after the tail cleared.
+ * @return	0 if success, -1 otherwise.
+ */
+int loadTail(fs_t *fs, int t);
+
+/*
+ * @brief	Releases the append slots, or only the one of a file if inode is not -1.
+ */
+void releaseTails(fs_t *fs, int inode);
+
+/*
+ * @brief	Appends bytes at the tail of a file opened in append mode, writing each touched block once from the copy kept in memory.
+ * @return	Number of bytes appended, -2 in case of error.
+ */
+int appendWrite(fs_t *fs, int t, char *buffer, int numBytes);
+
+/*
+ * @brief	Writes the inode blocks and the superblock to the disk.
+ * @return	0 if success, -1 otherwise.
+ */
+int syncMetadata(fs_t *fs);
+
+/*
+ * @brief	Lays out an empty file system in memory: the superblock, the root inode and the block functions for the block size. Nothing is written.
+ * @return	0 if success, -1 otherwise.
+ */
+int formatFS(fs_t *fs, long deviceSize, int blockSize);
+
+/*
+ * @brief	Fills block with the inodes that go in the inode block x, as they are stored in the device: the files are closed and at their beginning.
+ */
+void packInodeBlock(fs_t *fs, int x, char *block);
+
+/*
+ * @brief	Writes the modified inodes to the inode blocks of the disk.
+ * @return	0 if success, -1 otherwise.
+ */
+int writeInodes(fs_t *fs);
+
+/*
+ * @brief	Reads the inodes from the inode blocks of the disk, the blocks not initialized yet are empty.
+ * @return	0 if success, -1 otherwise.
+ */
+int readInodes(fs_t *fs);
+
+/*
+ * @brief	Writes the superblock to the disk.
+ * @return	0 if success, -1 otherwise.
+ */
+int writeSuperBlock(fs_t *fs);
+
+/*
+ * @brief	Records the name hash and the parent of an inode in the lookup index, a free inode matches no lookup.
+ */
+void indexInode(fs_t *fs, int i);
+
+/*
+ * @brief	Rebuilds the lookup index from all the inodes.
+ */
+void indexInodes(fs_t *fs);
+
+/*
+ * @brief	Looks for the entry of a directory with the given name.
+ * @return	The index of the inode of the entry, -1 if there is none.
+ */
+int findEntry(fs_t *fs, int dir, char *name);
+
+/*
+ * @brief	Looks for a free entry in the contents of a directory.
+ * @return	The position of the entry, -1 if the directory is full.
+ */
+int freeEntry(fs_t *fs, int dir);
+
+/*
+ * @brief	Follows a path from the root, one name at a time. Paths of directories end in '/'.
+ * @return	The index of the inode of the path, -1 if it does not exist.
+ */
+int lookupPath(fs_t *fs, char *path);
+
+/*
+ * @brief	Finds the directory that contains a path and copies the last name of the path, without its '/'.
+ * @return	The index of the inode of the directory, -1 if it does not exist, -2 if the name is too long or empty.
+ */
+int lookupParent(fs_t *fs, char *path, char name[33]);
+
+/*
+ * @brief	Computes how many levels of directories there are below a directory.
+ * @return	0 for files and empty directories, the number of levels otherwise.
+ */
+int treeHeight(fs_t *fs, int n);
+
+/*
+ * @brief	Lists an inode and everything below it, every directory before its contents.
+ * @return	The number of inodes copied into tree.
+ */
+int collectTree(fs_t *fs, int n, int tree[40]);
+
+/*
+ * @brief	Computes how many data blocks hold the record of a snapshot with the block size of the file system.
+ * @return	The number of data blocks.
+ */
+int snapshotBlocks(fs_t *fs);
+
+/*
+ * @brief	Reads the records of the snapshots listed in the superblock.
+ * @return	0 if success, -1 otherwise.
+ */
+int readSnapshots(fs_t *fs);
+
+#endif
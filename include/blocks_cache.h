@@ -35,4 +35,90 @@ int bread(char *deviceName, int blockNumber, char *buffer);
  * Returns 0 if correct or -1 in case of error.
  */
 int bwrite(char *deviceName, int blockNumber, char*buffer);
+
+/********************************/
+/* Block sizes other than 2048. */
+/********************************/
+
+#define MIN_BLOCK_SIZE 1024
+#define MAX_BLOCK_SIZE 65536
+
+/*
+ * Reads and writes blocks of a fixed size, with the same return values as
+ * bread and bwrite. breadv and bwritev transfer count blocks from or to
+ * consecutive buffers, merging the runs of consecutive block numbers.
+ * breadvec and bwritevec do the same with a separate buffer for each block,
+ * moving every run with a single preadv/pwritev call.
+ * bdiscardv punches holes for count blocks in the image, so they read as
+ * zeros and the host gets their space back. bsync makes the blocks written
+ * so far durable with fdatasync.
+ */
+typedef struct blockDevice {
+	int size;
+	int shift; // size == 1 << shift
+	int (*bread)(char *deviceName, int blockNumber, char *buffer);
+	int (*bwrite)(char *deviceName, int blockNumber, char *buffer);
+	int (*breadv)(char *deviceName, const int *blockNumbers, int count, char *buffers);
+	int (*bwritev)(char *deviceName, const int *blockNumbers, int count, char *buffers);
+	int (*breadvec)(char *deviceName, const int *blockNumbers, int count, char **buffers);
+	int (*bwritevec)(char *deviceName, const int *blockNumbers, int count, char **buffers);
+	int (*bdiscardv)(char *deviceName, const int *blockNumbers, int count);
+	int (*bsync)(char *deviceName);
+} blockDevice;
+
+/*
+ * Returns the block functions for a block size, or NULL if the size is not
+ * a power of two between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE.
+ */
+const struct blockDevice *blockDeviceFor(int blockSize);
+
+/*
+ * Same as blockDeviceFor, but the image is opened with O_DIRECT so the page
+ * cache of the host is skipped. Buffers aligned to DIRECT_ALIGN go straight
+ * to the device, the rest are copied through an aligned one.
+ */
+#define DIRECT_ALIGN 4096
+const struct blockDevice *blockDeviceDirect(int blockSize);
+
+/*******************/
+/* Request queue.  */
+/*******************/
+
+#define QUEUE_DEPTH 64
+
+/*
+ * Writes issued between bplug and bunplug are kept in the queue instead of
+ * going to the device. On unplug, or once window writes are waiting, the
+ * data blocks are submitted first and the metadata blocks (the ones below
+ * firstDataBlock) after them, so the metadata never points to blocks that
+ * are not written yet. Each group is sorted by block number and submitted
+ * with one bwritevec, so every run of consecutive blocks becomes a single
+ * pwritev. Reads are not queued. A write to a block that
+ * is already queued replaces it, and reads are served from the queue when
+ * the block is waiting there. With a window of 0 or 1 every write goes to
+ * the device at once.
+ */
+typedef struct blockQueue {
+	int plugged; // Nesting depth of the bplug calls
+	int window; // Writes kept before they are submitted anyway
+	int firstDataBlock; // Blocks below it hold metadata
+	int count;
+	int blockNumbers[QUEUE_DEPTH];
+	char *buffers[QUEUE_DEPTH]; // Copies of the blocks, each one in a slot
+	char *slots; // QUEUE_DEPTH aligned block buffers, lent by the file system; without them writes are not queued
+} blockQueue;
+
+void bplug(blockQueue *q);
+
+/*
+ * Returns 0 or -1 in case of error, of this unplug or of any write that was
+ * waiting in the queue.
+ */
+int bunplug(blockQueue *q, const struct blockDevice *dev, char *deviceName);
+
+/*
+ * Return 0 or -1 in case of error, as bread and bwrite.
+ */
+int bqueueRead(blockQueue *q, const struct blockDevice *dev, char *deviceName, int blockNumber, char *buffer);
+int bqueueWrite(blockQueue *q, const struct blockDevice *dev, char *deviceName, int blockNumber, char *buffer);
 #endif
@@ -0,0 +1,51 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	events.h
+ * @brief 	Trace points recorded in per-thread ring buffers.
+ * @date	01/03/2017
+ *
+ * The trace points are only compiled in when FS_EVENTS is defined (make
+ * EVENTS=1); otherwise EVENT_BEGIN and EVENT_END expand to nothing.
+ */
+
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include "filesystem.h" // Identifiers of the calls of the interface
+
+// Kinds of events besides the calls of the interface, which use the FS_OP_* identifiers, numbered after them
+#define EVENT_BREAD (FS_NUM_OPS + 0)
+#define EVENT_BWRITE (FS_NUM_OPS + 1)
+#define EVENT_INODE_FLUSH (FS_NUM_OPS + 2)
+#define EVENT_SUPERBLOCK_FLUSH (FS_NUM_OPS + 3)
+#define EVENT_BSYNC (FS_NUM_OPS + 4)
+#define EVENT_NUM_KINDS (FS_NUM_OPS + 5)
+
+#define EVENT_RING_SIZE 4096 // Events kept per thread, it must be a power of two
+
+typedef struct fsEvent{
+
+  unsigned long long timestamp; //Nanoseconds of CLOCK_MONOTONIC.
+  unsigned int tid; //Number given to the thread when it recorded its first event.
+  unsigned short kind;
+  char phase; //'B' when the event begins and 'E' when it ends.
+  char pad;
+  long long arg; //Block number for block I/O, result of the call on 'E' for the calls.
+
+} fsEvent;
+
+#ifdef FS_EVENTS
+#define EVENT_BEGIN(kind_, arg_) eventRecord((kind_), 'B', (arg_))
+#define EVENT_END(kind_, arg_) eventRecord((kind_), 'E', (arg_))
+#else
+#define EVENT_BEGIN(kind_, arg_) ((void)0)
+#define EVENT_END(kind_, arg_) ((void)0)
+#endif
+
+/*
+ * @brief	Stores an event in the ring buffer of the calling thread.
+ */
+void eventRecord(int kind, char phase, long long arg);
+
+#endif
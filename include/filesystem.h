@@ -14,16 +14,89 @@
 #include "blocks_cache.h" // Headers for block managing (read/write)
 
 #define DEVICE_IMAGE "disk.dat" // Device name
-#define MAX_FILE_SIZE 2048      // Maximum file size, in bytes
+// Maximum file size, in bytes, of a file system with blocks of BLOCK_SIZE (2048). The limit of a mounted file system
+// is FILE_BLOCKS times its block size, so images formatted with other sizes allow larger or smaller files.
+#define MAX_FILE_SIZE 32768
 #define FS_SEEK_CUR 0
-#define FS_SEEK_END 1
-#define FS_SEEK_BEGIN 2
+#define FS_SEEK_BEGIN 1
+#define FS_SEEK_END 2
+#define NUM_GROUPS 4           // Block groups, each with a slice of the inodes and of the data blocks
+#define GROUP_INODES 10        // Inodes of each block group, a file gets one from the group of its directory
+
+// Identifiers of the calls of the interface, used by the statistics and the trace log
+#define FS_OP_MKFS 0
+#define FS_OP_MOUNT 1
+#define FS_OP_UNMOUNT 2
+#define FS_OP_CREATE 3
+#define FS_OP_REMOVE 4
+#define FS_OP_OPEN 5
+#define FS_OP_CLOSE 6
+#define FS_OP_READ 7
+#define FS_OP_WRITE 8
+#define FS_OP_LSEEK 9
+#define FS_OP_MKDIR 10
+#define FS_OP_RMDIR 11
+#define FS_OP_LSDIR 12
+#define FS_OP_RENAME 13
+#define FS_OP_RMTREE 14
+#define FS_OP_COPYTREE 15
+#define FS_OP_FSYNC 16
+#define FS_OP_STAT 17
+#define FS_OP_OPENDIR 18
+#define FS_OP_READDIR 19
+#define FS_OP_CLOSEDIR 20
+#define FS_NUM_OPS 21
+
+#define FS_LATENCY_BUCKETS 32 // Bucket k counts the calls that took between 2^k and 2^(k+1) nanoseconds
+
+typedef struct fsStats{
+
+  unsigned long calls[FS_NUM_OPS]; //Number of calls to each function of the interface.
+  unsigned long latency[FS_NUM_OPS][FS_LATENCY_BUCKETS]; //Histogram of the duration of the calls.
+
+  unsigned long breads; //Blocks read from the device.
+  unsigned long bwrites; //Blocks written to the device.
+  unsigned long bytes_read;
+  unsigned long bytes_written;
+  unsigned long device_requests; //Calls to the device, each one moves one block or a run of consecutive ones.
+
+  unsigned long inode_flushes; //Times the inode blocks were written to the device.
+  unsigned long superblock_flushes; //Times the superblock was written to the device.
+
+} fsStats;
+
+typedef struct fs fs_t; // Handle of a file system stored in a device image
+
+typedef struct fsDirEntry{
+
+  int inode; //Inode of the entry, as in lsDir.
+  char type; //'F' for files and 'D' for directories.
+  int size; //Size in bytes for files, 0 for directories.
+  char name[33]; //Name of the entry inside the directory.
+
+} fsDirEntry;
+
+typedef struct fsFileStat{
+
+  int inode; //Inode of the file or directory, the descriptor of a file when it is opened.
+  char type; //'F' for files and 'D' for directories.
+  int size; //Length in bytes for files, 0 for directories.
+  int blocks; //Data blocks used by a file, its holes not included.
+
+} fsFileStat;
 
 /*
  * @brief 	Generates the proper file system structure in a storage device, as designed by the student.
  * @return 	0 if success, -1 otherwise.
  */
 int mkFS(long deviceSize);
+
+/*
+ * @brief 	Like mkFS, with blocks of blockSize bytes (a power of two from 1024 to 65536) instead of BLOCK_SIZE.
+ * @return 	0 if success, -1 otherwise.
+ */
+int mkFSBlockSize(long deviceSize, int blockSize);
+
 /*
  * @brief 	Mounts a file system in the simulated device.
  * @return 	0 if success, -1 otherwise.
@@ -54,12 +127,30 @@ int removeFile(char *path);
  */
 int openFile(char *path);
 
+/*
+ * @brief	Opens an existing file in append mode: every write goes to the end of its data, whatever the seek pointer.
+ * @return	The file descriptor if possible, -1 if file does not exist, -2 in case of error..
+ */
+int openFileAppend(char *path);
+
 /*
  * @brief	Closes a file.
  * @return	0 if success, -1 otherwise.
  */
 int closeFile(int fileDescriptor);
 
+/*
+ * @brief	Writes the buffered writes of a file and makes them durable in the device.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsyncFile(int fileDescriptor);
+
+/*
+ * @brief	Fills stat with the type, the length and the number of data blocks of a file or directory.
+ * @return	0 if success, -1 if the path does not exist, -2 in case of error.
+ */
+int statFile(char *path, fsFileStat *stat);
+
 /*
  * @brief	Reads a number of bytes from a file and stores them in a buffer.
  * @return	Number of bytes properly read, -1 in case of error.
@@ -96,4 +187,175 @@ int rmDir(char *path);
  */
 int lsDir(char *path, int inodesDir[10], char namesDir[10][33]);
 
+/*
+ * @brief	Renames or moves a file or a directory with all its contents, replacing the file in the new path if it exists.
+ * @return	0 if success, -1 if the old path does not exist or the new one is a directory that exists, -2 in case of error.
+ */
+int renamePath(char *oldPath, char *newPath);
+
+/*
+ * @brief	Deletes a file or a directory with everything inside, writing the metadata only once.
+ * @return	0 if success, -1 if the path does not exist, -2 in case of error.
+ */
+int rmTree(char *path);
+
+/*
+ * @brief	Copies a file or a directory with everything inside to a new path, writing the metadata only once.
+ * @return	0 if success, -1 if the source does not exist or the destination exists, -2 in case of error.
+ */
+int copyTree(char *srcPath, char *dstPath);
+
+/*
+ * @brief	Starts a listing of the entries of a directory.
+ * @return	The iterator descriptor if possible, -1 if the directory does not exist, -2 in case of error.
+ */
+int openDirIter(char *path);
+
+/*
+ * @brief	Copies up to maxEntries of the next entries of the directory, with their inode, type and size.
+ * @return	Number of entries copied (0 at the end of the directory), -1 in case of error.
+ */
+int readDirIter(int iter, fsDirEntry *entries, int maxEntries);
+
+/*
+ * @brief	Finishes a directory listing.
+ * @return	0 if success, -1 otherwise.
+ */
+int closeDirIter(int iter);
+
+/*
+ * @brief	Enables or disables the sharing of identical data blocks between files.
+ * @return	0 if success, -1 otherwise.
+ */
+int setDedupMode(int enabled);
+
+/*
+ * @brief	Chooses between zeroing the freed data blocks at once or discarding them later.
+ * @return	0 if success, -1 otherwise.
+ */
+int setSecureErase(int enabled);
+
+/*
+ * @brief	Enables or disables the access to the image with O_DIRECT, so blocks are only cached by the file system.
+ * @return	0 if success, -1 otherwise.
+ */
+int setDirectIO(int enabled);
+
+/*
+ * @brief	Enables or disables buffering the writes of each opened file, which are written when the file is closed or synced, when its buffer is full or once the oldest one is maxAgeMs old. The age is checked when the files are read, written, sought or closed, so a buffer can wait longer if none of them is called. A buffer that cannot be written is kept and written again later, and its file is not closed.
+ * @return	0 if success, -1 otherwise.
+ */
+int setWriteBehind(int enabled, int maxAgeMs);
+
+/*
+ * @brief	Sets how many block writes of a call are kept to be sorted and merged before they are submitted, 0 to submit each one at once.
+ * @return	0 if success, -1 otherwise.
+ */
+int setIoWindow(int requests);
+
+/*
+ * @brief	Discards now the freed data blocks that are waiting, giving their space back to the host.
+ * @return	0 if success, -1 otherwise.
+ */
+int discard(void);
+
+/*
+ * @brief	Freezes the current state of the file system under a name. The snapshot is kept in the device until it is deleted.
+ * @return	0 if success, -1 if the snapshot already exists, -2 in case of error.
+ */
+int createSnapshot(char *name);
+
+/*
+ * @brief	Deletes a snapshot.
+ * @return	0 if success, -1 if the snapshot does not exist, -2 in case of error.
+ */
+int deleteSnapshot(char *name);
+
+/*
+ * @brief	Opens a snapshot read-only in a handle of its own, while the file system stays writable. The handle is released with fsClose.
+ * @return	The handle of the snapshot if success, NULL otherwise.
+ */
+fs_t *openSnapshot(char *name);
+
+/*
+ * @brief	Starts recording every call to the file system in a binary log.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsTraceStart(char *logPath);
+
+/*
+ * @brief	Stops recording calls and closes the log.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsTraceStop(void);
+
+/*
+ * @brief	Copies the statistics collected since the last reset.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsGetStats(fsStats *stats);
+
+/*
+ * @brief	Sets all the statistics to zero.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsResetStats(void);
+
+/*
+ * @brief	Writes the events recorded by the trace points to a file (only with make EVENTS=1).
+ * @return	Number of events written, -1 in case of error.
+ */
+int fsEventsDump(char *path);
+
+/*
+ * Handle interface. The calls above work on the file system of DEVICE_IMAGE;
+ * the calls below do the same on the file system of the handle given, so
+ * several device images can be used at the same time from different threads.
+ */
+
+/*
+ * @brief	Creates a handle for the file system stored in a device image.
+ * @return	The handle if success, NULL otherwise.
+ */
+fs_t *fsOpen(const char *image);
+
+/*
+ * @brief	Unmounts the file system of a handle if needed and releases the handle. A handle that cannot be unmounted, as while a snapshot of it is opened, is kept.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsClose(fs_t *fs);
+
+int fsMkFS(fs_t *fs, long deviceSize);
+int fsMkFSBlockSize(fs_t *fs, long deviceSize, int blockSize);
+int fsMountFS(fs_t *fs);
+int fsUnmountFS(fs_t *fs);
+int fsCreateFile(fs_t *fs, char *path);
+int fsRemoveFile(fs_t *fs, char *path);
+int fsOpenFile(fs_t *fs, char *path);
+int fsOpenFileAppend(fs_t *fs, char *path);
+int fsCloseFile(fs_t *fs, int fileDescriptor);
+int fsFsyncFile(fs_t *fs, int fileDescriptor);
+int fsStatFile(fs_t *fs, char *path, fsFileStat *stat);
+int fsReadFile(fs_t *fs, int fileDescriptor, void *buffer, int numBytes);
+int fsWriteFile(fs_t *fs, int fileDescriptor, void *buffer, int numBytes);
+int fsLseekFile(fs_t *fs, int fileDescriptor, long offset, int whence);
+int fsMkDir(fs_t *fs, char *path);
+int fsRmDir(fs_t *fs, char *path);
+int fsLsDir(fs_t *fs, char *path, int inodesDir[10], char namesDir[10][33]);
+int fsRenamePath(fs_t *fs, char *oldPath, char *newPath);
+int fsRmTree(fs_t *fs, char *path);
+int fsCopyTree(fs_t *fs, char *srcPath, char *dstPath);
+int fsOpenDirIter(fs_t *fs, char *path);
+int fsReadDirIter(fs_t *fs, int iter, fsDirEntry *entries, int maxEntries);
+int fsCloseDirIter(fs_t *fs, int iter);
+int fsSetDedupMode(fs_t *fs, int enabled);
+int fsSetSecureErase(fs_t *fs, int enabled);
+int fsSetDirectIO(fs_t *fs, int enabled);
+int fsSetWriteBehind(fs_t *fs, int enabled, int maxAgeMs);
+int fsSetIoWindow(fs_t *fs, int requests);
+int fsDiscard(fs_t *fs);
+int fsCreateSnapshot(fs_t *fs, char *name);
+int fsDeleteSnapshot(fs_t *fs, char *name);
+fs_t *fsOpenSnapshot(fs_t *fs, char *name);
+
 #endif
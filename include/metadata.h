@@ -7,6 +7,8 @@
  */
 
 
+#include <pthread.h>
+
 #define bitmap_getbit(bitmap_, i_) (bitmap_[i_ >> 3] & (1 << (i_ & 0x07)))
 static inline void bitmap_setbit(char *bitmap_, int i_, int val_) {
   if (val_)
@@ -17,8 +19,16 @@ static inline void bitmap_setbit(char *bitmap_, int i_, int val_) {
 #ifndef STRUCT_SUPERBLOCK
 #define STRUCT_SUPERBLOCK
 
+#define FS_MAGIC 0x4F534449 //Identifies a device formatted with mkFS, with inodes that map several blocks and record the length of the file
+#define FILE_BLOCKS 16 //Number of data blocks a file can map, its holes included
+#define MAX_SNAPSHOTS 4 //Snapshots kept in the device at the same time
+#define SNAPSHOT_BLOCKS 8 //Data blocks that hold the record of a snapshot with the smallest block size
+#define POOL_BUFFERS 96 //Block buffers of the pool: the ones kept by the write buffers and the append tails between calls, and the most a call takes at once
+
 typedef struct sBlock{
 
+  unsigned int magic; //Identifies a disk formatted with mkFS.
+
   int mounted;//Boolean to indicate if the disk is mounted (0 is closed 1 is open)
 
   char bitmap[5]; //These will represent the 40 blocks that can be used for files.
@@ -27,6 +37,22 @@ typedef struct sBlock{
 
   int partitionBlocks;//Size of the partition of the disk that will be used for the File System
 
+  int block_size; //Size in bytes of the blocks, chosen when the file system is created.
+
+  int first_data_block; //The superblock and the inodes go before this block, the data blocks after it.
+
+  unsigned int initialized_inode_blocks; //Bit i is set once inode block i+1 has been written, the rest are read as empty.
+
+  char dedup; //Boolean to indicate if identical data blocks are shared between files (0 is off 1 is on)
+
+  unsigned char block_refs[40]; //Number of files referencing each of the 40 data blocks.
+
+  unsigned int block_hash[40]; //Hash of the content of each data block, used as the deduplication index.
+
+  char secure_erase; //Boolean to indicate if freed data blocks are zeroed at once instead of discarded later (0 is off 1 is on)
+
+  int snapshot_blocks[MAX_SNAPSHOTS][SNAPSHOT_BLOCKS]; //Data blocks holding the record of each snapshot, 0 for the free slots.
+
 } sBlock;
 
 #endif
@@ -37,19 +63,127 @@ typedef struct sBlock{
 typedef struct inode{
 
   int id;
-  char dir_path[99];
-  char file_path[132];
-  char type; //This will be either "F" for file or "D" for directory.
-  struct inode * parent; //Pointer to the directory where the inode is contained.
+  char name[33]; //Name inside the parent directory, the path is found following the parents. Empty for the root.
+  char type; //This will be either "F" for file or "D" for directory, 0 for a free inode.
+  int parent; //Index of the directory where the inode is contained.
 
   //Variables for directories:
-  struct inode * contents[10]; //This will only be used in the case that it is the inode for a directory.
+  int contents[10]; //Indexes of the contained inodes, 0 (the root) marks a free entry. This will only be used in the case that it is the inode for a directory.
 
   //Variables for files:
   char opened; //This will be either "Y" or "N".
   int seek_ptr; //Seek pointer for the file.
-  int block; //Will define the block where the file content is stored.
+  int size; //Length of the file in bytes, up to the last byte written. Reads stop here.
+  int blocks[FILE_BLOCKS]; //Block map of the file: blocks[k] stores the bytes from k*block_size on, 0 for a hole that reads as zeros.
 
 } inode;
 
 #endif
+
+#ifndef STRUCT_SNAPSHOT
+#define STRUCT_SNAPSHOT
+
+typedef struct snapshot{
+
+  char used; //Boolean to indicate if the snapshot slot is in use.
+  char name[33]; //Name given to the snapshot when it was created.
+  char bitmap[5]; //Copy of the bitmap, every block set here holds one reference.
+  struct inode inodes[40]; //Copy of the inodes at the time of the snapshot.
+
+} snapshot;
+
+#endif
+
+#ifndef STRUCT_DIRITER
+#define STRUCT_DIRITER
+
+typedef struct dirIter{
+
+  char used; //Boolean to indicate if the iterator is in use.
+  int dir; //Index of the inode of the directory being listed.
+  int pos; //Next entry of the contents of the directory to return.
+
+} dirIter;
+
+#endif
+
+#ifndef STRUCT_WRITEBUFFER
+#define STRUCT_WRITEBUFFER
+
+typedef struct writeBuffer{
+
+  char used; //Boolean to indicate if the buffer belongs to an opened file.
+  int inode; //Index of the inode of the file.
+  int count; //Number of blocks held, in the order they were first written.
+  int index[4]; //Position in the file of each block held.
+  char *blocks[4]; //Content of each block held, as it will be written.
+  long since; //Time of the oldest write that is not in the disk yet, in nanoseconds.
+
+} writeBuffer;
+
+#endif
+
+#ifndef STRUCT_APPENDTAIL
+#define STRUCT_APPENDTAIL
+
+typedef struct appendTail{
+
+  char used; //Boolean to indicate if the slot belongs to a file opened in append mode.
+  int inode; //Index of the inode of the file.
+  int tail; //Offset where the next append goes, the end of the data of the file.
+  char *block; //Copy of the block that holds the tail, so appending does not read it again.
+
+} appendTail;
+
+#endif
+
+#ifndef STRUCT_NAMEINDEX
+#define STRUCT_NAMEINDEX
+
+//Lookup keys of the directory entries, kept in arrays so several inodes are compared with one vector instruction.
+//The inodes themselves are not split: they are the records stored in the disk and copied whole by the snapshots.
+typedef struct nameIndex{
+
+  unsigned int hash[40]; //Hash of the name of each inode, so lookups compare names only when the hashes match.
+  int parent[40]; //Parent of each inode next to its hash, -1 for the free inodes and the root.
+
+} nameIndex;
+
+#endif
+
+#ifndef STRUCT_FS
+#define STRUCT_FS
+
+typedef struct fs{
+
+  char image[256]; //Path of the device image that stores the file system.
+  int trace_id; //Identifies the handle in the trace log, 0 for the calls without a handle.
+  const struct blockDevice *dev; //Block functions for the block size of the file system.
+  struct sBlock superBlock; //Superblock where metadata is stored.
+  struct inode inodes[40]; //Array where all the inodes are contained.
+  struct inode disk_inodes[40]; //Inodes as they are in the disk, so only the modified inode blocks are written.
+  struct nameIndex names; //Lookup index of the names of the inodes, rebuilt from them.
+
+  struct snapshot snapshots[MAX_SNAPSHOTS]; //Frozen copies of the inodes and the bitmap, as stored in the device.
+  int snapshot_view; //Index of the snapshot this handle is a read-only view of, -1 for the file system itself.
+  struct fs *parent; //File system a snapshot view was opened from.
+  int snapshot_views[MAX_SNAPSHOTS]; //Number of read-only views opened of each snapshot.
+
+  struct dirIter dir_iters[8]; //Directory listings opened with openDirIter.
+  struct appendTail tails[8]; //Files opened with openFileAppend, with their tail block kept in memory.
+  pthread_mutex_t append_lock; //Held while a tail is set up or moved, so appenders in different threads do not overlap.
+  struct writeBuffer write_buffers[8]; //Writes of the opened files that are not in the disk yet.
+  char write_behind; //Boolean to indicate if the writes are buffered instead of written at once (0 is off 1 is on)
+  long write_behind_age; //Nanoseconds a buffered write can wait before it is written.
+
+  unsigned long long pending_discard; //Bit n is set while the freed data block n waits to be discarded.
+
+  char direct; //Boolean to indicate if the image is accessed with O_DIRECT, skipping the page cache of the host (0 is off 1 is on)
+  char *pool; //Aligned buffers for the blocks, allocated once for the block size of the file system.
+  int pool_block_size; //Block size the buffers of the pool were allocated for.
+  char pool_used[POOL_BUFFERS]; //Boolean per buffer of the pool, set while it is taken.
+  struct blockQueue queue; //Block writes of the current call waiting to be sorted and merged.
+
+} fs;
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	stats.h
+ * @brief 	Headers for the collection of the statistics of the file system.
+ * @date	01/03/2017
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/*
+ * @brief	Takes the time at which a call of the interface starts.
+ * @return	The current time in nanoseconds.
+ */
+long statsStart(void);
+
+/*
+ * @brief	Counts a call of the interface and adds its duration to the histogram.
+ */
+void statsEnd(int op, long start);
+
+/*
+ * @brief	Counts a block read from the device.
+ */
+void statsBlockRead(int bytes);
+
+/*
+ * @brief	Counts a block written to the device.
+ */
+void statsBlockWrite(int bytes);
+
+/*
+ * @brief	Counts a call to the device, which moves one block or a run of consecutive ones.
+ */
+void statsDeviceRequest(void);
+
+/*
+ * @brief	Counts a write of the inode blocks.
+ */
+void statsInodeFlush(void);
+
+/*
+ * @brief	Counts a write of the superblock.
+ */
+void statsSuperBlockFlush(void);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	trace.h
+ * @brief 	Binary format of the operation traces recorded by the file system.
+ * @date	01/03/2017
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Every call is stored as this header, with op being one of the FS_OP_*
+ * identifiers of filesystem.h, followed by path_len bytes of the path (without
+ * the end of string character). For lseekFile the whence is stored in size,
+ * and for mkFS the device size is stored in offset and the block size in size.
+ * For readFile and writeFile the position of the file is stored in offset.
+ * For renamePath and copyTree the two paths are stored one after the other,
+ * with the length of the first one in size. mkFS and mountFS store the device
+ * image of the handle as their path, so the calls of every handle can be
+ * replayed on their own image.
+ */
+typedef struct traceRecord{
+
+  unsigned long long timestamp; //Nanoseconds of CLOCK_MONOTONIC when the call was issued.
+  long long offset;
+  int handle; //Handle the call was made on, 0 for the calls without a handle.
+  int fd;
+  int size;
+  unsigned char op;
+  unsigned char path_len;
+
+} __attribute__((packed)) traceRecord;
+
+/*
+ * @brief	Tells if the calls are being recorded.
+ * @return	1 if a trace log is open, 0 otherwise.
+ */
+int traceEnabled(void);
+
+/*
+ * @brief	Appends a call to the trace log if tracing is enabled.
+ */
+void traceCall(int handle, int op, char *path, int fd, int size, long offset);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	mkimage.c
+ * @brief 	Builds a device image from a directory of the host, without mounting it.
+ * @date	01/03/2017
+ *
+ * Usage: ./mkimage <host directory> <num_blocks> [block_size [image]]
+ *
+ * The directory is walked once and the file system is laid out in memory by
+ * the library itself: formatFS writes the superblock, allocInode chooses the
+ * inode of each entry in the block group of its directory and allocGoal and
+ * allocDataBlock place the data blocks, as createFile, mkDir and writeFile
+ * would. The image is then written with a single sequential write, so the
+ * time depends on the amount of data and not on the number of files. The
+ * image mounts with mountFS. The image is disk.dat unless another is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "include/filesystem.h"
+#include "include/metadata.h"
+#include "include/auxiliary.h"
+
+#define NUM_INODES 40
+
+static fs_t *target; // File system being laid out
+static char *image; // Blocks of the image, in the order they are written
+static int used_blocks; // Blocks of the image up to the last data block taken
+
+static int slashes(const char *path)
+{
+	int n = 0;
+	for (; *path; path++)
+		n += *path == '/';
+	return n;
+}
+
+/*
+ * Copies a file of the host into the data blocks. Blocks of zeros are left as
+ * holes, as writeFile does.
+ */
+static int add_file(const char *host, int i)
+{
+	FILE *f = fopen(host, "rb");
+	if (!f) {
+		fprintf(stderr, "ERROR: UNABLE TO OPEN %s\n", host);
+		return -1;
+	}
+	int block_size = target->superBlock.block_size, first_data_block = target->superBlock.first_data_block;
+	char block[block_size];
+	int ret = 0;
+	for (int k = 0; k < FILE_BLOCKS; k++) {
+		size_t n = fread(block, 1, block_size, f);
+		if (!n)
+			break;
+		target->inodes[i].size += n;
+		memset(block + n, 0, block_size - n);
+		int zeros = 1;
+		for (size_t b = 0; zeros && b < n; b++)
+			zeros = !block[b];
+		if (!zeros) {
+			int d = allocDataBlock(target, allocGoal(target, i, k));
+			if (d == -1) {
+				fprintf(stderr, "ERROR: NOT ENOUGH DATA BLOCKS FOR %s\n", host);
+				ret = -1;
+				break;
+			}
+			target->inodes[i].blocks[k] = d + first_data_block;
+			target->superBlock.block_hash[d] = blockHash(block, block_size);
+			memcpy(image + (size_t)(d + first_data_block) * block_size, block, block_size);
+			if (d + first_data_block + 1 > used_blocks)
+				used_blocks = d + first_data_block + 1;
+		}
+		if (n < (size_t)block_size)
+			break;
+		if (k == FILE_BLOCKS - 1 && fgetc(f) != EOF) {
+			fprintf(stderr, "ERROR: %s IS LARGER THAN %d BYTES\n", host, FILE_BLOCKS * block_size);
+			ret = -1;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+/*
+ * Adds the contents of a directory of the host below inode dir, whose path in
+ * the file system is path. The same limits as createFile and mkDir apply.
+ */
+static int add_dir(const char *host, int dir, const char *path)
+{
+	DIR *d = opendir(host);
+	if (!d) {
+		fprintf(stderr, "ERROR: UNABLE TO OPEN DIRECTORY %s\n", host);
+		return -1;
+	}
+	struct dirent *entry;
+	int entries = 0, ret = 0;
+	while (ret == 0 && (entry = readdir(d))) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+		char host_path[4096], fs_path[256];
+		struct stat st;
+		snprintf(host_path, sizeof(host_path), "%s/%s", host, entry->d_name);
+		if (stat(host_path, &st) != 0 || (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)))
+			continue; // Only files and directories have a place in the file system
+		int is_dir = S_ISDIR(st.st_mode);
+		snprintf(fs_path, sizeof(fs_path), "%s%s%s", path, entry->d_name, is_dir ? "/" : "");
+
+		int i = -1;
+		if (strlen(entry->d_name) > 32) {
+			fprintf(stderr, "ERROR: THE NAME OF %s IS LONGER THAN 32 CHARACTERS\n", host_path);
+			ret = -1;
+		} else if (strlen(fs_path) > (is_dir ? 99 : 132) || slashes(fs_path) > 5) {
+			fprintf(stderr, "ERROR: %s IS TOO DEEP\n", host_path);
+			ret = -1;
+		} else if (entries == 10) {
+			fprintf(stderr, "ERROR: %s HAS MORE THAN 10 ENTRIES\n", host);
+			ret = -1;
+		} else if ((i = allocInode(target, dir, is_dir ? 'D' : 'F')) == -1) {
+			fprintf(stderr, "ERROR: THERE ARE MORE THAN %d ITEMS\n", NUM_INODES);
+			ret = -1;
+		}
+		if (ret != 0)
+			break;
+
+		bzero(&target->inodes[i], sizeof(struct inode));
+		target->inodes[i].id = i;
+		strcpy(target->inodes[i].name, entry->d_name);
+		target->inodes[i].type = is_dir ? 'D' : 'F';
+		target->inodes[i].parent = dir;
+		indexInode(target, i);
+		target->inodes[dir].contents[entries++] = i;
+		target->superBlock.num_items++;
+		if (is_dir) {
+			ret = add_dir(host_path, i, fs_path);
+		} else {
+			target->inodes[i].opened = 'N';
+			ret = add_file(host_path, i);
+		}
+	}
+	closedir(d);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3 || argc > 5) {
+		fprintf(stderr, "Syntax: ./mkimage <host directory> <num_blocks> [block_size [image]]\n");
+		return -1;
+	}
+	int num_blocks = atoi(argv[2]);
+	int block_size = argc >= 4 ? atoi(argv[3]) : BLOCK_SIZE;
+	char *name = argc == 5 ? argv[4] : DEVICE_IMAGE;
+	long device_size = (long)num_blocks * block_size;
+	if (!(target = fsOpen(name)))
+		return -1;
+	if (formatFS(target, device_size, block_size) != 0) {
+		fsClose(target);
+		return -1;
+	}
+	int first_data_block = target->superBlock.first_data_block;
+	int data_blocks = num_blocks - first_data_block < NUM_INODES ? num_blocks - first_data_block : NUM_INODES;
+
+	// The image is built in memory: the superblock, the inode blocks and the data blocks, in this order
+	image = calloc((size_t)first_data_block + data_blocks, block_size);
+	if (!image) {
+		fprintf(stderr, "ERROR: OUT OF MEMORY\n");
+		fsClose(target);
+		return -1;
+	}
+	used_blocks = first_data_block;
+	if (add_dir(argv[1], 0, "/") != 0) {
+		free(image);
+		fsClose(target);
+		return -1;
+	}
+
+	target->superBlock.initialized_inode_blocks = (1u << (first_data_block - 1)) - 1;
+	memcpy(image, &target->superBlock, sizeof(struct sBlock));
+	for (int x = 1; x < first_data_block; x++)
+		packInodeBlock(target, x, image + (size_t)x * block_size);
+
+	// One write up to the last data block used, the rest of the device is left sparse as create_disk does
+	size_t length = (size_t)used_blocks * block_size;
+	int fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: UNABLE TO OPEN DISK FILE %s\n", name);
+		free(image);
+		fsClose(target);
+		return -1;
+	}
+	size_t done = 0;
+	while (done < length) {
+		ssize_t n = pwrite(fd, image + done, length - done, done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	free(image);
+	if (done < length || ftruncate(fd, device_size) < 0) {
+		fprintf(stderr, "ERROR: UNABLE TO WRITE DISK FILE %s\n", name);
+		close(fd);
+		fsClose(target);
+		return -1;
+	}
+	close(fd);
+	int used = 0;
+	for (int n = 0; n < NUM_INODES; n++)
+		used += !!bitmap_getbit(target->superBlock.bitmap, n);
+	printf("%s: %d items, %d of %d data blocks used\n", name, target->superBlock.num_items, used, data_blocks);
+	fsClose(target);
+	return 0;
+}
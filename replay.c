@@ -0,0 +1,221 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	replay.c
+ * @brief 	Replays a trace recorded with fsTraceStart against the images it was recorded on.
+ * @date	01/03/2017
+ *
+ * Usage: ./replay <trace file> [max]
+ *
+ * By default the calls are issued with the same spacing they were recorded
+ * with; with "max" they are issued back to back. The latency of every call
+ * is measured and summarized per operation at the end.
+ *
+ * Every handle of the recording gets its own handle, opened on the image
+ * named by its first mkFS or mountFS, relative to the current directory. The
+ * calls of a handle that was never formatted or mounted in the trace, as a
+ * snapshot, are skipped. Reads and writes start at the recorded position.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "include/filesystem.h"
+#include "include/trace.h"
+
+#define MAX_IO 65536
+#define MAX_HANDLES 64
+
+static const char *op_names[FS_NUM_OPS] = {
+	"mkFS", "mountFS", "unmountFS", "createFile", "removeFile", "openFile", "closeFile",
+	"readFile", "writeFile", "lseekFile", "mkDir", "rmDir", "lsDir", "renamePath",
+	"rmTree", "copyTree", "fsyncFile", "statFile", "openDirIter", "readDirIter", "closeDirIter"
+};
+
+typedef struct latencies {
+	long *ns;
+	int n, cap;
+} latencies;
+
+static latencies results[FS_NUM_OPS];
+static char io_buffer[MAX_IO + 1];
+
+static int handle_ids[MAX_HANDLES]; // Handle of the recording each replayed handle stands for
+static fs_t *handles[MAX_HANDLES];
+static int num_handles;
+
+static long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int record(int op, long elapsed)
+{
+	latencies *l = &results[op];
+	if (l->n == l->cap) {
+		int cap = l->cap ? l->cap * 2 : 1024;
+		long *ns = realloc(l->ns, cap * sizeof(long));
+		if (!ns)
+			return -1;
+		l->ns = ns;
+		l->cap = cap;
+	}
+	l->ns[l->n++] = elapsed;
+	return 0;
+}
+
+/*
+ * Returns the handle for the calls of a recorded handle, opening it on the
+ * image of a mkFS or mountFS the first time. NULL if the calls are skipped.
+ */
+static fs_t *handle_for(struct traceRecord *rec, char *path)
+{
+	for (int h = 0; h < num_handles; h++)
+		if (handle_ids[h] == rec->handle)
+			return handles[h];
+	if ((rec->op != FS_OP_MKFS && rec->op != FS_OP_MOUNT) || !rec->path_len || num_handles == MAX_HANDLES)
+		return NULL;
+	fs_t *fs = fsOpen(path);
+	if (fs) {
+		handle_ids[num_handles] = rec->handle;
+		handles[num_handles++] = fs;
+	}
+	return fs;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Issues the call described by a record. Descriptors are inode numbers, so
+ * replaying the same calls over the same image yields the recorded ones.
+ */
+static void issue(fs_t *fs, struct traceRecord *rec, char *path)
+{
+	int fd = rec->fd;
+	int size = rec->size < 0 ? 0 : (rec->size > MAX_IO ? MAX_IO : rec->size);
+	int inodesDir[10];
+	char namesDir[10][33];
+	fsFileStat stat;
+	fsDirEntry entries[10];
+
+	switch (rec->op) {
+	case FS_OP_MKFS: fsMkFSBlockSize(fs, rec->offset, rec->size ? rec->size : BLOCK_SIZE); break;
+	case FS_OP_MOUNT: fsMountFS(fs); break;
+	case FS_OP_UNMOUNT: fsUnmountFS(fs); break;
+	case FS_OP_CREATE: fsCreateFile(fs, path); break;
+	case FS_OP_REMOVE: fsRemoveFile(fs, path); break;
+	case FS_OP_OPEN: rec->size ? fsOpenFileAppend(fs, path) : fsOpenFile(fs, path); break;
+	case FS_OP_CLOSE: fsCloseFile(fs, fd); break;
+	case FS_OP_READ: fsReadFile(fs, fd, io_buffer, size); break;
+	case FS_OP_WRITE:
+		memset(io_buffer, 'a', size);
+		io_buffer[size] = '\0';
+		fsWriteFile(fs, fd, io_buffer, size);
+		break;
+	case FS_OP_LSEEK: fsLseekFile(fs, fd, rec->offset, rec->size); break;
+	case FS_OP_MKDIR: fsMkDir(fs, path); break;
+	case FS_OP_RMDIR: fsRmDir(fs, path); break;
+	case FS_OP_LSDIR: fsLsDir(fs, path, inodesDir, namesDir); break;
+	case FS_OP_RENAME:
+	case FS_OP_COPYTREE:
+		if (size < (int)strlen(path)) {
+			char first_path[256];
+			memcpy(first_path, path, size);
+			first_path[size] = '\0';
+			if (rec->op == FS_OP_RENAME)
+				fsRenamePath(fs, first_path, path + size);
+			else
+				fsCopyTree(fs, first_path, path + size);
+		}
+		break;
+	case FS_OP_RMTREE: fsRmTree(fs, path); break;
+	case FS_OP_FSYNC: fsFsyncFile(fs, fd); break;
+	case FS_OP_STAT: fsStatFile(fs, path, &stat); break;
+	case FS_OP_OPENDIR: fsOpenDirIter(fs, path); break;
+	case FS_OP_READDIR: fsReadDirIter(fs, fd, entries, size < 10 ? size : 10); break;
+	case FS_OP_CLOSEDIR: fsCloseDirIter(fs, fd); break;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "max"))) {
+		fprintf(stderr, "Syntax: ./replay <trace file> [max]\n");
+		return -1;
+	}
+	int max_speed = (argc == 3);
+
+	FILE *log = fopen(argv[1], "rb");
+	if (!log) {
+		fprintf(stderr, "ERROR: UNABLE TO OPEN TRACE FILE %s\n", argv[1]);
+		return -1;
+	}
+
+	struct traceRecord rec;
+	char path[256];
+	long first_recorded = -1, replay_start = now_ns();
+
+	while (fread(&rec, sizeof(rec), 1, log) == 1) {
+		if (rec.path_len && fread(path, 1, rec.path_len, log) != rec.path_len)
+			break;
+		path[rec.path_len] = '\0';
+		if (rec.op >= FS_NUM_OPS) {
+			fprintf(stderr, "ERROR: UNKNOWN OPERATION %d IN TRACE\n", rec.op);
+			fclose(log);
+			return -1;
+		}
+
+		if (first_recorded == -1)
+			first_recorded = rec.timestamp;
+		if (!max_speed) {
+			// Waits until the call is due with the spacing of the recording
+			long due = replay_start + ((long)rec.timestamp - first_recorded);
+			long wait = due - now_ns();
+			if (wait > 0) {
+				struct timespec ts = {wait / 1000000000L, wait % 1000000000L};
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		fs_t *fs = handle_for(&rec, path);
+		if (!fs)
+			continue;
+		if ((rec.op == FS_OP_READ || rec.op == FS_OP_WRITE) && rec.offset >= 0) {
+			// FS_SEEK_BEGIN goes back to the first byte and FS_SEEK_CUR moves on from it. Not timed, as the recording has its own lseekFile calls
+			fsLseekFile(fs, rec.fd, 0, FS_SEEK_BEGIN);
+			fsLseekFile(fs, rec.fd, rec.offset, FS_SEEK_CUR);
+		}
+		long start = now_ns();
+		issue(fs, &rec, path);
+		if (record(rec.op, now_ns() - start) != 0) {
+			fprintf(stderr, "ERROR: OUT OF MEMORY\n");
+			fclose(log);
+			return -1;
+		}
+	}
+	fclose(log);
+	for (int h = 0; h < num_handles; h++)
+		fsClose(handles[h]);
+
+	printf("%-12s %10s %12s %12s %12s %12s\n", "op", "calls", "mean_ns", "p50_ns", "p99_ns", "max_ns");
+	for (int op = 0; op < FS_NUM_OPS; op++) {
+		latencies *l = &results[op];
+		if (l->n == 0)
+			continue;
+		qsort(l->ns, l->n, sizeof(long), cmp_long);
+		long total = 0;
+		for (int k = 0; k < l->n; k++)
+			total += l->ns[k];
+		printf("%-12s %10d %12ld %12ld %12ld %12ld\n", op_names[op], l->n, total / l->n,
+			   l->ns[l->n * 50 / 100], l->ns[l->n * 99 / 100], l->ns[l->n - 1]);
+		free(l->ns);
+	}
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	stats.c
+ * @brief 	Collection of the statistics of the file system.
+ * @date	01/03/2017
+ *
+ * The counters are updated with relaxed atomic additions, so they can be
+ * collected from several threads without locks on the read/write path.
+ */
+
+#include "include/filesystem.h"
+#include "include/stats.h"
+#include <string.h>
+#include <time.h>
+
+#define STATS_ADD(counter_, value_) __atomic_fetch_add(&(counter_), (value_), __ATOMIC_RELAXED)
+
+static struct fsStats stats;//Statistics collected since the last reset
+
+/*
+ * @brief	Takes the time at which a call of the interface starts.
+ * @return	The current time in nanoseconds.
+ */
+long statsStart(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000L+ts.tv_nsec;
+}
+
+/*
+ * @brief	Counts a call of the interface and adds its duration to the histogram.
+ */
+void statsEnd(int op, long start)
+{
+	unsigned long elapsed=(unsigned long)(statsStart()-start);
+	int bucket=elapsed ? 63-__builtin_clzl(elapsed) : 0;//The buckets are the powers of two
+	if(bucket>=FS_LATENCY_BUCKETS) bucket=FS_LATENCY_BUCKETS-1;
+
+	STATS_ADD(stats.calls[op], 1);
+	STATS_ADD(stats.latency[op][bucket], 1);
+}
+
+/*
+ * @brief	Counts a block read from the device.
+ */
+void statsBlockRead(int bytes)
+{
+	STATS_ADD(stats.breads, 1);
+	STATS_ADD(stats.bytes_read, bytes);
+}
+
+/*
+ * @brief	Counts a block written to the device.
+ */
+void statsBlockWrite(int bytes)
+{
+	STATS_ADD(stats.bwrites, 1);
+	STATS_ADD(stats.bytes_written, bytes);
+}
+
+/*
+ * @brief	Counts a call to the device, which moves one block or a run of consecutive ones.
+ */
+void statsDeviceRequest(void)
+{
+	STATS_ADD(stats.device_requests, 1);
+}
+
+/*
+ * @brief	Counts a write of the inode blocks.
+ */
+void statsInodeFlush(void)
+{
+	STATS_ADD(stats.inode_flushes, 1);
+}
+
+/*
+ * @brief	Counts a write of the superblock.
+ */
+void statsSuperBlockFlush(void)
+{
+	STATS_ADD(stats.superblock_flushes, 1);
+}
+
+/*
+ * @brief	Copies the statistics collected since the last reset.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsGetStats(fsStats *out)
+{
+	if(!out) return -1;
+
+	unsigned long *src=(unsigned long *)&stats, *dst=(unsigned long *)out;
+	for(size_t k=0;k<sizeof(struct fsStats)/sizeof(unsigned long);k++){
+		dst[k]=__atomic_load_n(&src[k], __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+/*
+ * @brief	Sets all the statistics to zero.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsResetStats(void)
+{
+	unsigned long *counters=(unsigned long *)&stats;
+	for(size_t k=0;k<sizeof(struct fsStats)/sizeof(unsigned long);k++){
+		__atomic_store_n(&counters[k], 0, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
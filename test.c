@@ -8,7 +8,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "include/filesystem.h"
+#include "include/trace.h"
 
 // Color definitions for asserts
 #define ANSI_COLOR_RESET "\x1b[0m"
@@ -19,12 +25,138 @@
 #define N_BLOCKS 25					  // Number of blocks in the device
 #define DEV_SIZE N_BLOCKS *BLOCK_SIZE // Device size, in bytes
 
+// Creates an empty device image of the given size for the tests that use their own handle
+static int createImage(const char *path, long size)
+{
+	int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0666);
+	if (fd < 0)
+		return -1;
+	int ret = ftruncate(fd, size);
+	close(fd);
+	return ret;
+}
+
+#define ERASE_MARKER "secure erase marker"
+
+// Returns the offset of the pattern in the image, -1 if it is not there or the image cannot be read
+static long imageFind(const char *path, const char *pattern)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	char *data = fstat(fd, &st) == 0 ? malloc(st.st_size) : NULL;
+	long found = -1;
+	if (data && read(fd, data, st.st_size) == st.st_size)
+	{
+		size_t length = strlen(pattern);
+		for (off_t k = 0; found == -1 && k + (off_t)length <= st.st_size; k++)
+			found = memcmp(data + k, pattern, length) ? -1 : (long)k;
+	}
+	free(data);
+	close(fd);
+	return found;
+}
+
+// Returns 1 if the block of the image holding the given offset only has zeros, 0 otherwise
+static int imageBlockZeros(const char *path, long offset)
+{
+	char block[BLOCK_SIZE];
+	int fd = open(path, O_RDONLY);
+	int zeros = fd >= 0 && pread(fd, block, BLOCK_SIZE, offset - offset % BLOCK_SIZE) == BLOCK_SIZE;
+	for (int k = 0; zeros && k < BLOCK_SIZE; k++)
+		zeros = !block[k];
+	if (fd >= 0)
+		close(fd);
+	return zeros;
+}
+
+// Returns the number of records of a trace log, -1 if any of them is not a whole call of the handle given
+static int traceRecords(const char *path, int handle)
+{
+	FILE *log = fopen(path, "rb");
+	if (!log)
+		return -1;
+	struct traceRecord rec;
+	char recPath[256];
+	int n = 0;
+	while (n != -1 && fread(&rec, sizeof(rec), 1, log) == 1)
+	{
+		if (rec.op >= FS_NUM_OPS || rec.handle != handle || (rec.path_len && fread(recPath, 1, rec.path_len, log) != rec.path_len))
+			n = -1;
+		else
+			n++;
+	}
+	fclose(log);
+	return n;
+}
+
+#define APPEND_CHUNK 64
+#define APPEND_COUNT 20
+
+/*
+ * Appends APPEND_COUNT chunks of the letter given in arg to /dir2/app.log.
+ */
+static void *appender(void *arg)
+{
+	char chunk[APPEND_CHUNK + 1];
+	memset(chunk, *(char *)arg, APPEND_CHUNK);
+	chunk[APPEND_CHUNK] = '\0';
+	int fd = openFileAppend("/dir2/app.log");
+	for (int k = 0; k < APPEND_COUNT; k++)
+	{
+		if (writeFile(fd, chunk, APPEND_CHUNK) != APPEND_CHUNK)
+			return (void *)-1;
+	}
+	return NULL;
+}
+
 int main()
 {
 	int ret;
 
 	///////
 
+	ret = mkFSBlockSize(DEV_SIZE, 3000);
+	if (ret != -1)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST mkFSBlockSize ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST mkFSBlockSize ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	///////
+
+	//A file larger than 2048 bytes keeps its data with the smallest and a larger block size after a remount
+	int blockSizes[2] = {1024, 4096};
+	char sizeData[5001], sizeRead[5000]; // writeFile stops at the end of string character
+	for (int k = 0; k < (int)sizeof(sizeRead); k++)
+		sizeData[k] = 'A' + k % 26;
+	sizeData[sizeof(sizeRead)] = '\0';
+	for (int s = 0; s < 2; s++)
+	{
+		long sizeDevice = (50000 / blockSizes[s] + 1) * (long)blockSizes[s];
+		fs_t *sized = fsOpen("disk_bs.dat");
+		bzero(sizeRead, sizeof(sizeRead));
+		ret = !sized || createImage("disk_bs.dat", sizeDevice);
+		ret |= fsMkFSBlockSize(sized, sizeDevice, blockSizes[s]) | fsMountFS(sized) | fsCreateFile(sized, "/big");
+		int fdSized = fsOpenFile(sized, "/big");
+		ret |= fsWriteFile(sized, fdSized, sizeData, sizeof(sizeRead)) != sizeof(sizeRead);
+		ret |= fsCloseFile(sized, fdSized) | fsUnmountFS(sized) | fsMountFS(sized);
+		fdSized = fsOpenFile(sized, "/big");
+		ret |= fsReadFile(sized, fdSized, sizeRead, sizeof(sizeRead)) != sizeof(sizeRead);
+		ret |= fsCloseFile(sized, fdSized) | fsClose(sized);
+		unlink("disk_bs.dat");
+		if (ret != 0 || memcmp(sizeRead, sizeData, sizeof(sizeRead)))
+		{
+			fprintf(stdout, "%s%s%d %s%s%s", ANSI_COLOR_BLUE, "TEST mkFSBlockSize ", blockSizes[s], ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+			return -1;
+		}
+		fprintf(stdout, "%s%s%d %s%s%s", ANSI_COLOR_BLUE, "TEST mkFSBlockSize ", blockSizes[s], ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	}
+
+	///////
+
 	ret = mkFS(DEV_SIZE);
 	if (ret != 0)
 	{
@@ -382,6 +514,609 @@ int main()
 		return -1;
 	}
 	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST readFile ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	///////
+
+	ret = setDedupMode(1);
+	if (ret != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST setDedupMode ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST setDedupMode ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	///////
+
+	createFile("/dir2/dedup1.txt");
+	createFile("/dir2/dedup2.txt");
+	int fd1 = openFile("/dir2/dedup1.txt");
+	int fd2 = openFile("/dir2/dedup2.txt");
+	char *config = "key=value";
+	fsStats dedupStats;
+	fsResetStats();
+	writeFile(fd1, config, strlen(config));
+	fsGetStats(&dedupStats);
+	unsigned long firstWrites = dedupStats.bwrites;
+	//The second copy shares the data block of the first, so only the metadata is written
+	fsResetStats();
+	writeFile(fd2, config, strlen(config));
+	fsGetStats(&dedupStats);
+	closeFile(fd1);
+	ret = removeFile("/dir2/dedup1.txt");
+	char buffer4[2048];
+	bzero(buffer4, sizeof(buffer4));
+	lseekFile(fd2, 0, FS_SEEK_BEGIN);
+	if (ret != 0 || dedupStats.bwrites != firstWrites - 1 || readFile(fd2, buffer4, strlen(config)) != strlen(config) || strcmp(buffer4, config))
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST dedup ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST dedup ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	closeFile(fd2);
+	///////
+
+	ret = createSnapshot("backup");
+	if (ret != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST createSnapshot ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST createSnapshot ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	///////
+
+	fd1 = openFile("/test432.txt");
+	writeFile(fd1, "HOLA", 4);
+	closeFile(fd1);
+	fs_t *backup = openSnapshot("backup");
+	int fd3 = backup ? fsOpenFile(backup, "/test432.txt") : -1;
+	bzero(buffer4, sizeof(buffer4));
+	fsReadFile(backup, fd3, buffer4, 4);
+	fsCloseFile(backup, fd3);
+	//The file system stays writable while the snapshot is read
+	ret = backup ? fsCreateFile(backup, "/readonly.txt") : 0;
+	fd1 = openFile("/test432.txt");
+	int live = writeFile(fd1, "HOLA", 4);
+	closeFile(fd1);
+	if (!backup || strcmp(buffer4, "hola") || ret != -2 || live != 4 || deleteSnapshot("backup") != -2)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST openSnapshot ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST openSnapshot ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	///////
+
+	//The snapshot is kept in the device, so it is still there after mounting again
+	ret = fsClose(backup);
+	if (ret == 0 && unmountFS() == 0 && mountFS() == 0 && (backup = openSnapshot("backup")))
+	{
+		fd3 = fsOpenFile(backup, "/test432.txt");
+		bzero(buffer4, sizeof(buffer4));
+		fsReadFile(backup, fd3, buffer4, 4);
+		fsCloseFile(backup, fd3);
+		ret = fsClose(backup);
+	}
+	else
+	{
+		ret = -1;
+	}
+	char live_data[5];
+	bzero(live_data, sizeof(live_data));
+	fd1 = openFile("/test432.txt");
+	readFile(fd1, live_data, 4);
+	closeFile(fd1);
+	if (ret != 0 || strcmp(buffer4, "hola") || strcmp(live_data, "HOLA") || deleteSnapshot("backup") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST snapshot after mountFS ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST snapshot after mountFS ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	///////
+
+	fsResetStats();
+	lsDir("/dir1/", inodesDir, namesDir);
+	fsStats stats;
+	ret = fsGetStats(&stats);
+	if (ret != 0 || stats.calls[FS_OP_LSDIR] != 1 || stats.calls[FS_OP_CREATE] != 0 || stats.bwrites != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsGetStats ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsGetStats ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	///////
+
+	bzero(inodesDir, 10*sizeof(int));
+	lsDir("/", inodesDir, namesDir);
+	fsDirEntry entries[10];
+	int iter = openDirIter("/"), listed = 0, batch;
+	ret = iter < 0 ? -1 : 0;
+	while (ret == 0 && (batch = readDirIter(iter, entries + listed, 2)) > 0)
+	{
+		if (batch > 2)
+			ret = -1;
+		listed += batch;
+	}
+	for (int k = 0, e = 0; ret == 0 && k < 10; k++)
+	{
+		if (inodesDir[k] == 0)
+			continue;
+		if (e >= listed || entries[e].inode != inodesDir[k] || strchr(entries[e].name, '/') != NULL)
+			ret = -1;
+		e++;
+	}
+	if (ret != 0 || listed == 0 || closeDirIter(iter) != 0 || readDirIter(iter, entries, 1) != -1)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST readDirIter ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST readDirIter ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	///////
+
+	createFile("/dir4/tmp.txt");
+	createFile("/dir4/tmp2.txt");
+	ret = renamePath("/dir4/tmp.txt", "/dir4/pub.txt");
+	if (ret == 0)
+		ret = renamePath("/dir4/tmp2.txt", "/dir4/pub.txt");
+	if (ret == 0)
+		ret = renamePath("/dir4/", "/dir2/moved/");
+	fd1 = openFile("/dir2/moved/pub.txt");
+	if (ret != 0 || fd1 < 0 || openFile("/dir4/pub.txt") != -1 || openFile("/dir2/moved/tmp2.txt") != -1 ||
+		renamePath("/dir1/", "/dir1/test/dir1/") != -2 || renamePath("/dir2/moved/", "/dir1/") != -1)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST renamePath ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	closeFile(fd1);
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST renamePath ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	///////
+
+	setDedupMode(0);
+	fd1 = openFile("/dir2/moved/pub.txt");
+	writeFile(fd1, "pub", 3);
+	ret = copyTree("/dir2/", "/copy/");
+	lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	writeFile(fd1, "PUB", 3);
+	closeFile(fd1);
+	fd1 = openFile("/copy/moved/pub.txt");
+	bzero(buffer4, sizeof(buffer4));
+	readFile(fd1, buffer4, 3);
+	closeFile(fd1);
+	if (ret != 0 || strcmp(buffer4, "pub") || copyTree("/dir2/", "/copy/") != -1)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST copyTree ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST copyTree ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	///////
+
+	fsResetStats();
+	ret = rmTree("/copy/");
+	fsGetStats(&stats);
+	if (ret != 0 || openFile("/copy/moved/pub.txt") != -1 || stats.inode_flushes != 1 || stats.superblock_flushes != 1)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST rmTree ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST rmTree ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	///////
+
+	fsResetStats();
+	ret = createFile("/dir2/lock");
+	fsGetStats(&stats);
+	fd1 = openFile("/dir2/lock");
+	memset(buffer4, 'x', sizeof(buffer4));
+	if (ret != 0 || stats.breads != 0 || stats.bwrites > 3 || readFile(fd1, buffer4, 4) != 0 || memcmp(buffer4, "xxxx", 4))
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST createFile without data block ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	closeFile(fd1);
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST createFile without data block ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	///////
+
+	//The removed file takes three blocks, so at least one page of the image is freed whole
+	char oldData[3 * BLOCK_SIZE + 1];
+	for (int k = 0; k < 3 * BLOCK_SIZE; k++)
+		oldData[k] = 'o' + k / BLOCK_SIZE; // Different blocks, so none of them is shared
+	oldData[3 * BLOCK_SIZE] = '\0';
+	createFile("/dir2/old.log");
+	fd1 = openFile("/dir2/old.log");
+	writeFile(fd1, oldData, 3 * BLOCK_SIZE);
+	fsyncFile(fd1); // The host only counts the blocks of the image once they are allocated on its disk
+	closeFile(fd1);
+	createFile("/dir2/new.log");
+	fd1 = openFile("/dir2/new.log");
+	writeFile(fd1, ERASE_MARKER, strlen(ERASE_MARKER));
+	lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	bzero(buffer4, sizeof(buffer4));
+	readFile(fd1, buffer4, sizeof(buffer4) - 1);
+	closeFile(fd1);
+	discard(); // The blocks freed by the earlier tests are discarded first, so the removal does not fill a batch
+	fsResetStats();
+	ret = removeFile("/dir2/old.log");
+	fsGetStats(&stats);
+	struct stat beforeDiscard, afterDiscard;
+	ret |= stat(DEVICE_IMAGE, &beforeDiscard) | discard() | stat(DEVICE_IMAGE, &afterDiscard);
+	//With secure erase the freed block is zeroed at once, so it reads back as zeros from the image
+	long markerOffset = imageFind(DEVICE_IMAGE, ERASE_MARKER);
+	ret |= setSecureErase(1) | removeFile("/dir2/new.log") | setSecureErase(0);
+	if (ret != 0 || stats.bytes_written > 3 * 2048 || strcmp(buffer4, ERASE_MARKER) || afterDiscard.st_blocks >= beforeDiscard.st_blocks ||
+		markerOffset == -1 || !imageBlockZeros(DEVICE_IMAGE, markerOffset))
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST discard ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST discard ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	createFile("/dir2/sparse");
+	fd1 = openFile("/dir2/sparse");
+	lseekFile(fd1, 3 * 2048, FS_SEEK_CUR);
+	fsResetStats();
+	ret = writeFile(fd1, "tail", 4);
+	fsGetStats(&stats);
+	lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	lseekFile(fd1, 2048, FS_SEEK_CUR);
+	memset(buffer4, 'x', sizeof(buffer4));
+	int sparse_read = readFile(fd1, buffer4, 2048);
+	char sparse_tail[5] = {0};
+	lseekFile(fd1, 2048, FS_SEEK_CUR);
+	readFile(fd1, sparse_tail, 4);
+	closeFile(fd1);
+	if (ret != 4 || stats.bwrites > 3 || sparse_read != 2048 || buffer4[0] != 0 || buffer4[2047] != 0 ||
+		strcmp(sparse_tail, "tail") || removeFile("/dir2/sparse") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST sparse file ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST sparse file ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	createFile("/dir2/app.log");
+	fd1 = openFile("/dir2/app.log");
+	writeFile(fd1, "first", 5);
+	closeFile(fd1);
+	fd1 = openFileAppend("/dir2/app.log");
+	writeFile(fd1, "+second", 7);
+	lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	fsResetStats();
+	ret = writeFile(fd1, "+more", 5); // Writes the tail block and the inode with the new length
+	fsGetStats(&stats);
+	lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	bzero(buffer4, sizeof(buffer4));
+	readFile(fd1, buffer4, 32);
+	closeFile(fd1);
+	if (ret != 5 || stats.breads != 0 || stats.bwrites != 2 || strcmp(buffer4, "first+second+more") || removeFile("/dir2/app.log") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST openFileAppend ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST openFileAppend ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	//Two threads append at the same time, every chunk must be whole and none lost
+	createFile("/dir2/app.log");
+	pthread_t threads[2];
+	void *results[2] = {NULL, NULL};
+	char letters[2] = {'a', 'b'};
+	int traceStarted = fsTraceStart("append_trace.log"); // The records of both threads must stay whole
+	for (int k = 0; k < 2; k++)
+		pthread_create(&threads[k], NULL, appender, &letters[k]);
+	for (int k = 0; k < 2; k++)
+		pthread_join(threads[k], &results[k]);
+	int appendRecords = traceStarted == 0 && fsTraceStop() == 0 ? traceRecords("append_trace.log", 0) : -1;
+	unlink("append_trace.log");
+	char appended[2 * APPEND_COUNT * APPEND_CHUNK + 1];
+	bzero(appended, sizeof(appended));
+	fd1 = openFile("/dir2/app.log");
+	ret = readFile(fd1, appended, sizeof(appended));
+	closeFile(fd1);
+	int chunks[2] = {0, 0}, whole = 1;
+	for (int c = 0; c < 2 * APPEND_COUNT; c++)
+	{
+		char *chunk = appended + c * APPEND_CHUNK;
+		for (int b = 1; b < APPEND_CHUNK; b++)
+			whole &= chunk[b] == chunk[0];
+		if (chunk[0] == 'a' || chunk[0] == 'b')
+			chunks[chunk[0] - 'a']++;
+	}
+	if (results[0] || results[1] || ret != 2 * APPEND_COUNT * APPEND_CHUNK || !whole || chunks[0] != APPEND_COUNT ||
+		chunks[1] != APPEND_COUNT || appendRecords != 2 * (APPEND_COUNT + 1) || removeFile("/dir2/app.log") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST openFileAppend threads ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST openFileAppend threads ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	setDirectIO(1);
+	createFile("/dir2/direct");
+	fd1 = openFile("/dir2/direct");
+	ret = writeFile(fd1, "uncached", 8);
+	lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	bzero(buffer4, sizeof(buffer4));
+	readFile(fd1, buffer4, 8);
+	closeFile(fd1);
+	if (ret != 8 || strcmp(buffer4, "uncached") || removeFile("/dir2/direct") != 0 || setDirectIO(0) != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST setDirectIO ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST setDirectIO ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	setWriteBehind(1, 60000);
+	createFile("/dir2/behind");
+	fd1 = openFile("/dir2/behind");
+	fsResetStats();
+	writeFile(fd1, "one", 3);
+	writeFile(fd1, "two", 3);
+	writeFile(fd1, "six", 3);
+	fsGetStats(&stats);
+	unsigned long buffered_bwrites = stats.bwrites;
+	lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	bzero(buffer4, sizeof(buffer4));
+	readFile(fd1, buffer4, 9);
+	ret = fsyncFile(fd1);
+	fsGetStats(&stats);
+	closeFile(fd1);
+	if (buffered_bwrites != 0 || strcmp(buffer4, "onetwosix") || ret != 0 || stats.bwrites == 0 || stats.bwrites > 4 ||
+		setWriteBehind(0, 0) != 0 || removeFile("/dir2/behind") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsyncFile ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsyncFile ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	//A buffer older than the limit is written by the next call, even if it is not a write
+	setWriteBehind(1, 1);
+	createFile("/dir2/behind");
+	fd1 = openFile("/dir2/behind");
+	writeFile(fd1, "old", 3);
+	usleep(5000);
+	fsResetStats();
+	ret = lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	fsGetStats(&stats);
+	closeFile(fd1);
+	if (ret != 0 || stats.bwrites == 0 || setWriteBehind(0, 0) != 0 || removeFile("/dir2/behind") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST setWriteBehind age ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST setWriteBehind age ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	struct fsStats queued, unqueued;
+	char buffer5[3 * BLOCK_SIZE + 1]; // writeFile stops at the end of string character
+	memset(buffer5, 'q', 3 * BLOCK_SIZE);
+	buffer5[3 * BLOCK_SIZE] = '\0';
+	ret = createFile("/dir2/queued");
+	fd1 = openFile("/dir2/queued");
+	fsResetStats();
+	ret |= writeFile(fd1, buffer5, 3 * BLOCK_SIZE) != 3 * BLOCK_SIZE;
+	fsGetStats(&queued);
+	ret |= setIoWindow(0);
+	ret |= lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	fsResetStats();
+	ret |= writeFile(fd1, buffer5, 3 * BLOCK_SIZE) != 3 * BLOCK_SIZE;
+	fsGetStats(&unqueued);
+	closeFile(fd1);
+	if (ret != 0 || queued.device_requests == 0 || queued.device_requests >= queued.bwrites ||
+		unqueued.device_requests != unqueued.bwrites || setIoWindow(QUEUE_DEPTH + 1) != -1 ||
+		setIoWindow(QUEUE_DEPTH) != 0 || removeFile("/dir2/queued") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST setIoWindow ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST setIoWindow ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	int groupsDir[10], groupsFile[10];
+	char groupsNames[10][33];
+	ret = unmountFS() | mkFS(DEV_SIZE) | mountFS(); // The block groups are checked on an empty file system
+	ret |= mkDir("/grp1/") | mkDir("/grp2/") | createFile("/grp1/f") | createFile("/grp2/f");
+	int g1 = -1, g2 = -1, f1, f2;
+	memset(groupsNames, 0, sizeof(groupsNames));
+	ret |= lsDir("/", groupsDir, groupsNames);
+	for (int k = 0; k < 10; k++)
+	{
+		if (!strcmp(groupsNames[k], "grp1")) g1 = groupsDir[k];
+		if (!strcmp(groupsNames[k], "grp2")) g2 = groupsDir[k];
+	}
+	ret |= lsDir("/grp1/", groupsFile, groupsNames); // The only entry of a new directory is the first one
+	f1 = groupsFile[0];
+	ret |= lsDir("/grp2/", groupsFile, groupsNames);
+	f2 = groupsFile[0];
+	if (ret != 0 || g1 < 0 || g2 < 0 || g1 / GROUP_INODES == g2 / GROUP_INODES || f1 / GROUP_INODES != g1 / GROUP_INODES ||
+		f2 / GROUP_INODES != g2 / GROUP_INODES || rmTree("/grp1/") != 0 || rmTree("/grp2/") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST block groups ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST block groups ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	fsFileStat st;
+	char buffer8[64];
+	ret = createFile("/len");
+	fd1 = openFile("/len");
+	ret |= writeFile(fd1, "0123456789", 10) != 10;
+	ret |= lseekFile(fd1, 0, FS_SEEK_BEGIN);
+	memset(buffer8, 'x', sizeof(buffer8));
+	int len_read = readFile(fd1, buffer8, sizeof(buffer8));
+	ret |= lseekFile(fd1, 0, FS_SEEK_END);
+	ret |= writeFile(fd1, "ab", 2) != 2;
+	int eof_read = readFile(fd1, buffer8, sizeof(buffer8));
+	closeFile(fd1);
+	ret |= statFile("/len", &st);
+	if (ret != 0 || len_read != 10 || buffer8[10] != 'x' || eof_read != 0 || st.type != 'F' || st.size != 12 ||
+		st.blocks != 1 || statFile("/", &st) != 0 || st.type != 'D' || statFile("/none", &st) != -1 ||
+		removeFile("/len") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST statFile ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST statFile ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	fs_t *fsA = fsOpen("disk_a.dat"), *fsB = fsOpen("disk_b.dat");
+	char bufferA[16], bufferB[16];
+	bzero(bufferA, sizeof(bufferA));
+	bzero(bufferB, sizeof(bufferB));
+	ret = !fsA || !fsB || createImage("disk_a.dat", DEV_SIZE) || createImage("disk_b.dat", DEV_SIZE);
+	ret |= fsMkFS(fsA, DEV_SIZE) | fsMkFS(fsB, DEV_SIZE) | fsMountFS(fsA) | fsMountFS(fsB);
+	ret |= fsCreateFile(fsA, "/only_a") | fsCreateFile(fsB, "/only_b");
+	int fdA = fsOpenFile(fsA, "/only_a"), fdB = fsOpenFile(fsB, "/only_b");
+	ret |= fsWriteFile(fsA, fdA, "image a", 7) != 7 || fsWriteFile(fsB, fdB, "image b", 7) != 7;
+	ret |= fsCloseFile(fsA, fdA) | fsCloseFile(fsB, fdB) | fsUnmountFS(fsA) | fsMountFS(fsA);
+	fdA = fsOpenFile(fsA, "/only_a");
+	fdB = fsOpenFile(fsB, "/only_b");
+	ret |= fsReadFile(fsA, fdA, bufferA, sizeof(bufferA)) != 7 || fsReadFile(fsB, fdB, bufferB, sizeof(bufferB)) != 7;
+	ret |= fsOpenFile(fsA, "/only_b") != -1 || fsOpenFile(fsB, "/only_a") != -1 || openFile("/only_a") != -1;
+	ret |= fsClose(fsA) | fsClose(fsB);
+	unlink("disk_a.dat");
+	unlink("disk_b.dat");
+	if (ret != 0 || strcmp(bufferA, "image a") || strcmp(bufferB, "image b"))
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsOpen ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsOpen ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	//mkimage lays out a directory of the host as the library would, and the image mounts
+	mkdir("mkimage_fixture", 0777);
+	mkdir("mkimage_fixture/sub", 0777);
+	char fixture[3000], readback[3000];
+	for (int k = 0; k < (int)sizeof(fixture); k++)
+		fixture[k] = 'a' + k % 26;
+	FILE *host = fopen("mkimage_fixture/sub/data.bin", "wb");
+	fwrite(fixture, 1, sizeof(fixture), host);
+	fclose(host);
+	host = fopen("mkimage_fixture/hello.txt", "wb");
+	fputs("hello", host);
+	fclose(host);
+	fsFileStat subStat, dataStat;
+	bzero(readback, sizeof(readback));
+	ret = system("./mkimage mkimage_fixture 25 2048 mkimage.dat > /dev/null");
+	fs_t *made = ret == 0 ? fsOpen("mkimage.dat") : NULL;
+	if (made && fsMountFS(made) == 0)
+	{
+		fd1 = fsOpenFile(made, "/sub/data.bin");
+		ret = fsReadFile(made, fd1, readback, sizeof(readback)) != sizeof(readback);
+		fsCloseFile(made, fd1);
+		ret |= fsStatFile(made, "/sub/", &subStat) | fsStatFile(made, "/sub/data.bin", &dataStat);
+		ret |= fsClose(made);
+	}
+	else
+	{
+		ret = -1;
+	}
+	unlink("mkimage_fixture/sub/data.bin");
+	unlink("mkimage_fixture/hello.txt");
+	rmdir("mkimage_fixture/sub");
+	rmdir("mkimage_fixture");
+	unlink("mkimage.dat");
+	if (ret != 0 || memcmp(readback, fixture, sizeof(fixture)) || dataStat.size != sizeof(fixture) || dataStat.blocks != 2 ||
+		dataStat.inode / GROUP_INODES != subStat.inode / GROUP_INODES)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST mkimage ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST mkimage ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	//Opening and seeking a file only changes memory, so its inode block is not written again
+	fsFileStat farStat, nearStat;
+	ret = mkDir("/far/") | createFile("/far/a") | createFile("/far/b") | createFile("/far/c") | createFile("/near");
+	ret |= statFile("/far/c", &farStat) | statFile("/near", &nearStat);
+	fd1 = openFile("/near");
+	ret |= writeFile(fd1, "abc", 3) != 3;
+	ret |= lseekFile(fd1, -2, FS_SEEK_CUR);
+	fsResetStats();
+	ret |= renamePath("/far/c", "/far/d"); // Only the inode block of the renamed file changes
+	fsGetStats(&stats);
+	closeFile(fd1);
+	if (ret != 0 || farStat.inode / GROUP_INODES == nearStat.inode / GROUP_INODES || stats.bwrites != 1 ||
+		rmTree("/far/") != 0 || removeFile("/near") != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST inode blocks written ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST inode blocks written ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	//The listings are counted like the other calls, and need a mounted file system
+	fsDirEntry rootEntries[10];
+	fs_t *unmounted = fsOpen(DEVICE_IMAGE);
+	fsResetStats();
+	iter = openDirIter("/");
+	ret = readDirIter(iter, rootEntries, 10) < 0 || closeDirIter(iter) != 0;
+	fsGetStats(&stats);
+	if (ret != 0 || stats.calls[FS_OP_OPENDIR] != 1 || stats.calls[FS_OP_READDIR] != 1 || stats.calls[FS_OP_CLOSEDIR] != 1 ||
+		!unmounted || fsReadDirIter(unmounted, 0, rootEntries, 10) != -1 || fsCloseDirIter(unmounted, 0) != -1 || fsClose(unmounted) != 0)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST readDirIter calls ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST readDirIter calls ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	//A trace recorded on two images and replayed onto fresh ones leaves the same files as the recording
+	char traced[3001], replayed[3000]; // writeFile stops at the end of string character
+	fsFileStat tracedStat, replayedStat, renamedStat, otherStat, replayedOther;
+	memset(traced, 'a', sizeof(replayed)); // The replay writes the letter a
+	traced[sizeof(replayed)] = '\0';
+	fs_t *recorded = fsOpen("disk_trace.dat"), *other = fsOpen("disk_other.dat");
+	ret = !recorded || !other || createImage("disk_trace.dat", DEV_SIZE) || createImage("disk_other.dat", DEV_SIZE) || fsTraceStart("trace.log");
+	ret |= fsMkFS(recorded, DEV_SIZE) | fsMountFS(recorded) | fsMkFS(other, DEV_SIZE) | fsMountFS(other);
+	ret |= fsMkDir(recorded, "/t/") | fsCreateFile(recorded, "/t/a") | fsCreateFile(other, "/o");
+	fd1 = fsOpenFile(recorded, "/t/a");
+	fd2 = fsOpenFile(other, "/o");
+	ret |= fsWriteFile(recorded, fd1, traced, 1000) != 1000 || fsWriteFile(other, fd2, traced, 10) != 10;
+	ret |= fsWriteFile(recorded, fd1, traced, 2000) != 2000 || fsCloseFile(recorded, fd1) || fsCloseFile(other, fd2);
+	ret |= fsCreateFile(recorded, "/t/b") | fsRenamePath(recorded, "/t/b", "/t/c") | fsUnmountFS(recorded) | fsUnmountFS(other) | fsTraceStop();
+	ret |= fsMountFS(recorded) | fsStatFile(recorded, "/t/a", &tracedStat) | fsClose(recorded);
+	ret |= fsMountFS(other) | fsStatFile(other, "/o", &otherStat) | fsClose(other);
+	//The replay opens the images by the names they were recorded with, in its own directory
+	mkdir("replay_dir", 0777);
+	ret |= createImage("replay_dir/disk_trace.dat", DEV_SIZE) || createImage("replay_dir/disk_other.dat", DEV_SIZE);
+	ret |= system("cd replay_dir && ../replay ../trace.log max > /dev/null");
+	fs_t *replica = fsOpen("replay_dir/disk_trace.dat"), *otherReplica = fsOpen("replay_dir/disk_other.dat");
+	bzero(replayed, sizeof(replayed));
+	if (ret == 0 && replica && otherReplica && fsMountFS(replica) == 0 && fsMountFS(otherReplica) == 0)
+	{
+		ret = fsStatFile(replica, "/t/a", &replayedStat) | fsStatFile(replica, "/t/c", &renamedStat);
+		ret |= fsStatFile(replica, "/t/b", &renamedStat) != -1 || fsStatFile(replica, "/o", &renamedStat) != -1;
+		ret |= fsStatFile(otherReplica, "/o", &replayedOther) | (fsStatFile(otherReplica, "/t/", &renamedStat) != -1);
+		fd1 = fsOpenFile(replica, "/t/a");
+		ret |= fsReadFile(replica, fd1, replayed, sizeof(replayed)) != sizeof(replayed) || fsCloseFile(replica, fd1);
+	}
+	else
+	{
+		ret = -1;
+	}
+	if (replica)
+		fsClose(replica);
+	if (otherReplica)
+		fsClose(otherReplica);
+	unlink("replay_dir/disk_trace.dat");
+	unlink("replay_dir/disk_other.dat");
+	rmdir("replay_dir");
+	unlink("disk_trace.dat");
+	unlink("disk_other.dat");
+	unlink("trace.log");
+	if (ret != 0 || memcmp(replayed, traced, sizeof(replayed)) || replayedStat.inode != tracedStat.inode ||
+		replayedStat.size != tracedStat.size || replayedStat.blocks != tracedStat.blocks || replayedOther.size != otherStat.size)
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsTraceStart replay ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsTraceStart replay ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+	/////////////
+	//A handle with an opened snapshot is kept until the snapshot is closed, with its data
+	fs_t *parentFs = fsOpen("disk_view.dat"), *view = NULL;
+	char parentData[8];
+	bzero(parentData, sizeof(parentData));
+	ret = !parentFs || createImage("disk_view.dat", DEV_SIZE);
+	ret |= fsMkFS(parentFs, DEV_SIZE) | fsMountFS(parentFs) | fsCreateFile(parentFs, "/kept") | fsCreateSnapshot(parentFs, "view");
+	ret |= !(view = fsOpenSnapshot(parentFs, "view"));
+	fd1 = fsOpenFile(parentFs, "/kept");
+	ret |= fsWriteFile(parentFs, fd1, "kept", 4) != 4;
+	ret |= fsClose(parentFs) != -1; // The snapshot still reads its device
+	ret |= fsCloseFile(parentFs, fd1) | fsClose(view) | fsUnmountFS(parentFs) | fsMountFS(parentFs);
+	fd1 = fsOpenFile(parentFs, "/kept");
+	ret |= fsReadFile(parentFs, fd1, parentData, 4) != 4 || fsCloseFile(parentFs, fd1) || fsClose(parentFs);
+	unlink("disk_view.dat");
+	if (ret != 0 || strcmp(parentData, "kept"))
+	{
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsClose with snapshot opened ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST fsClose with snapshot opened ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
 	/////////////
 	ret = unmountFS();
 	if (ret != 0)
@@ -0,0 +1,98 @@
+/*
+ * OPERATING SYSTEMS DESING - 16/17
+ *
+ * @file 	trace.c
+ * @brief 	Recording of the calls to the file system in a binary log.
+ * @date	01/03/2017
+ */
+
+#include "include/filesystem.h"
+#include "include/trace.h"
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+static FILE *trace_log=NULL;//Log where the calls are recorded, NULL if tracing is disabled
+static pthread_mutex_t trace_lock=PTHREAD_MUTEX_INITIALIZER;//Held while a record is written or the log is opened or closed, so the records of several threads do not mix
+
+/*
+ * @brief	Starts recording every call to the file system in a log.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsTraceStart(char *logPath)
+{
+	pthread_mutex_lock(&trace_lock);
+	int ret=0;
+	if(trace_log){
+		printf("The trace is already being recorded\n");
+		ret=-1;
+	}
+	else{
+		FILE *log=fopen(logPath, "wb");
+		if(!log){
+			printf("Error while opening the trace log\n");
+			ret=-1;
+		}
+		__atomic_store_n(&trace_log, log, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return ret;
+}
+
+/*
+ * @brief	Stops recording calls and closes the log.
+ * @return	0 if success, -1 otherwise.
+ */
+int fsTraceStop(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	int ret=0;
+	if(!trace_log){
+		printf("The trace is not being recorded\n");
+		ret=-1;
+	}
+	else{
+		ret=fclose(trace_log) ? -1 : 0;
+		__atomic_store_n(&trace_log, NULL, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return ret;
+}
+
+/*
+ * @brief	Tells if the calls are being recorded.
+ * @return	1 if a trace log is open, 0 otherwise.
+ */
+int traceEnabled(void)
+{
+	return __atomic_load_n(&trace_log, __ATOMIC_RELAXED)!=NULL;
+}
+
+/*
+ * @brief	Appends a call to the trace log if tracing is enabled.
+ */
+void traceCall(int handle, int op, char *path, int fd, int size, long offset)
+{
+	if(!traceEnabled()) return;//Checked again with the lock held
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	struct traceRecord record;
+	record.timestamp=(unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+	record.offset=offset;
+	record.handle=handle;
+	record.fd=fd;
+	record.size=size;
+	record.op=(unsigned char)op;
+	size_t len=path ? strlen(path) : 0;
+	record.path_len=len>255 ? 255 : (unsigned char)len;
+
+	//The record and its path are written at once
+	char entry[sizeof(record)+255];
+	memcpy(entry, &record, sizeof(record));
+	if(record.path_len) memcpy(entry+sizeof(record), path, record.path_len);
+	pthread_mutex_lock(&trace_lock);
+	if(trace_log) fwrite(entry, 1, sizeof(record)+record.path_len, trace_log);
+	pthread_mutex_unlock(&trace_lock);
+}